@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mysnapshot.h"
+
+#define MAX_SITES 1024
+#define BUCKETS 48
+#define TOP_SITES 10
+
+// Map characters by chunk state, and the one for the headers between them
+static const char state_chars[] = ".#shq";
+#define NUM_STATES 5
+#define HEADER_CHAR '|'
+
+static const char* state_names[] = {"free", "allocated", "slab", "handle", "quick list"};
+
+typedef struct {
+    uint64_t number;
+    uint64_t length;
+    size_t first;  // index of its first chunk
+    size_t count;
+} arena_t;
+
+typedef struct {
+    uint8_t state;
+    uint16_t site;
+    uint32_t line;
+    uint64_t offset;
+    uint64_t size;
+} chunk_t;
+
+typedef struct {
+    arena_t* arenas;
+    size_t arena_count;
+    chunk_t* chunks;
+    size_t chunk_count;
+    char* sites[MAX_SITES + 1];  // by site number, 0 is unknown
+} snapshot_t;
+
+// One allocated size or site and how much of the heap it holds
+typedef struct {
+    uint64_t key;
+    size_t count;
+    uint64_t bytes;
+} tally_t;
+
+static void* grow(void* array, size_t* capacity, size_t count, size_t item) {
+    if (count < *capacity) {
+        return array;
+    }
+    *capacity = *capacity ? *capacity * 2 : 256;
+    array = realloc(array, *capacity * item);
+    if (!array) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+// Read a snapshot file, returns -1 if it is not a valid snapshot
+static int load_snapshot(const char* path, snapshot_t* snap) {
+    memset(snap, 0, sizeof(*snap));
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    snapshot_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: not a heap snapshot\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    size_t arena_capacity = 0;
+    size_t chunk_capacity = 0;
+    snapshot_record_t rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.type == SNAPSHOT_ARENA) {
+            snap->arenas = grow(snap->arenas, &arena_capacity, snap->arena_count, sizeof(arena_t));
+            arena_t* a = &snap->arenas[snap->arena_count++];
+            a->number = rec.offset;
+            a->length = rec.size;
+            a->first = snap->chunk_count;
+            a->count = 0;
+        } else if (rec.type == SNAPSHOT_CHUNK && snap->arena_count > 0 && rec.state < NUM_STATES) {
+            snap->chunks = grow(snap->chunks, &chunk_capacity, snap->chunk_count, sizeof(chunk_t));
+            chunk_t* c = &snap->chunks[snap->chunk_count++];
+            c->state = rec.state;
+            c->site = rec.site <= MAX_SITES ? rec.site : 0;
+            c->line = rec.line;
+            c->offset = rec.offset;
+            c->size = rec.size;
+            snap->arenas[snap->arena_count - 1].count++;
+        } else if (rec.type == SNAPSHOT_SITE && rec.site > 0 && rec.site <= MAX_SITES) {
+            char* name = malloc(rec.line + 1);
+            if (!name || fread(name, 1, rec.line, fp) != rec.line) {
+                fprintf(stderr, "%s: bad site record\n", path);
+                free(name);
+                fclose(fp);
+                return -1;
+            }
+            name[rec.line] = '\0';
+            free(snap->sites[rec.site]);
+            snap->sites[rec.site] = name;
+        } else {
+            fprintf(stderr, "%s: bad record after %zu chunks\n", path, snap->chunk_count);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static void free_snapshot(snapshot_t* snap) {
+    free(snap->arenas);
+    free(snap->chunks);
+    for (int i = 0; i <= MAX_SITES; i++) {
+        free(snap->sites[i]);
+    }
+}
+
+static int is_live(const chunk_t* c) {
+    return c->state == SNAPSHOT_USED || c->state == SNAPSHOT_HANDLE || c->state == SNAPSHOT_SLAB;
+}
+
+static int compare_key(const void* a, const void* b) {
+    uint64_t x = ((const tally_t*)a)->key;
+    uint64_t y = ((const tally_t*)b)->key;
+    return (x > y) - (x < y);
+}
+
+static int compare_bytes(const void* a, const void* b) {
+    uint64_t x = ((const tally_t*)a)->bytes;
+    uint64_t y = ((const tally_t*)b)->bytes;
+    return (x < y) - (x > y);
+}
+
+// Live blocks added up by size (by_site 0) or by site and line, sorted
+// by key. Returns the number of distinct keys.
+static size_t tally(const snapshot_t* snap, int by_site, tally_t** out) {
+    tally_t* t = malloc((snap->chunk_count + 1) * sizeof(tally_t));
+    if (!t) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < snap->chunk_count; i++) {
+        const chunk_t* c = &snap->chunks[i];
+        if (!is_live(c) || (by_site && c->site == 0)) {
+            continue;
+        }
+        t[n].key = by_site ? (uint64_t)c->site << 32 | c->line : c->size;
+        t[n].count = 1;
+        t[n].bytes = c->size;
+        n++;
+    }
+    qsort(t, n, sizeof(tally_t), compare_key);
+
+    size_t distinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (distinct > 0 && t[distinct - 1].key == t[i].key) {
+            t[distinct - 1].count++;
+            t[distinct - 1].bytes += t[i].bytes;
+        } else {
+            t[distinct++] = t[i];
+        }
+    }
+
+    *out = t;
+    return distinct;
+}
+
+static void print_site(const snapshot_t* snap, uint64_t key) {
+    const char* file = snap->sites[key >> 32];
+    printf("%s:%u", file ? file : "?", (unsigned)(key & 0xffffffff));
+}
+
+static void print_summary(const snapshot_t* snap) {
+    size_t count[NUM_STATES] = {0};
+    uint64_t bytes[NUM_STATES] = {0};
+    uint64_t heap = 0;
+    uint64_t largest = 0;
+
+    for (size_t i = 0; i < snap->arena_count; i++) {
+        heap += snap->arenas[i].length;
+    }
+    for (size_t i = 0; i < snap->chunk_count; i++) {
+        const chunk_t* c = &snap->chunks[i];
+        count[c->state]++;
+        bytes[c->state] += c->size;
+        if (c->state == SNAPSHOT_FREE && c->size > largest) {
+            largest = c->size;
+        }
+    }
+
+    printf("%zu arenas, %llu bytes\n", snap->arena_count, (unsigned long long)heap);
+    for (int s = 0; s < NUM_STATES; s++) {
+        if (count[s] > 0) {
+            printf("  %c %-10s %8zu chunks %12llu bytes\n", state_chars[s], state_names[s],
+                   count[s], (unsigned long long)bytes[s]);
+        }
+    }
+    printf("Largest free chunk: %llu bytes, fragmentation %.1f%%\n", (unsigned long long)largest,
+           bytes[SNAPSHOT_FREE] ? 100.0 * (1 - (double)largest / bytes[SNAPSHOT_FREE]) : 0);
+}
+
+// Free chunks by power-of-two size, so a heap whose free space is all in
+// small pieces shows up at a glance
+static void print_histogram(const snapshot_t* snap) {
+    size_t count[BUCKETS] = {0};
+    uint64_t bytes[BUCKETS] = {0};
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < snap->chunk_count; i++) {
+        const chunk_t* c = &snap->chunks[i];
+        if (c->state == SNAPSHOT_FREE && c->size > 0) {
+            int b = 63 - __builtin_clzll(c->size);
+            count[b]++;
+            bytes[b] += c->size;
+            total += c->size;
+        }
+    }
+
+    printf("\nFree chunks by size:\n");
+    printf("%22s %8s %12s\n", "size", "chunks", "bytes");
+    for (int b = 0; b < BUCKETS; b++) {
+        if (count[b] == 0) {
+            continue;
+        }
+        char range[32];
+        snprintf(range, sizeof(range), "%llu-%llu", 1ULL << b, (2ULL << b) - 1);
+        int bar = (int)(40 * bytes[b] / total);
+        printf("%22s %8zu %12llu %.*s\n", range, count[b], (unsigned long long)bytes[b],
+               bar ? bar : 1, "########################################");
+    }
+}
+
+// One character per cell of cell bytes, showing the state that covers
+// most of the cell. A cell taken up mostly by chunk headers shows '|'.
+static void print_map(const snapshot_t* snap, size_t cell, int width) {
+    printf("\nHeap map, %zu bytes per character (", cell);
+    for (int s = 0; s < NUM_STATES; s++) {
+        printf("%c %s, ", state_chars[s], state_names[s]);
+    }
+    printf("%c headers):\n", HEADER_CHAR);
+
+    for (size_t i = 0; i < snap->arena_count; i++) {
+        const arena_t* a = &snap->arenas[i];
+        size_t cells = (a->length + cell - 1) / cell;
+        uint64_t (*cover)[NUM_STATES + 1] = calloc(cells, sizeof(*cover));
+        if (!cover) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+
+        // split every chunk's header and payload over the cells they touch
+        for (size_t j = 0; j < a->count; j++) {
+            const chunk_t* c = &snap->chunks[a->first + j];
+            uint64_t spans[2][3] = {
+                {c->offset, c->offset + 8, NUM_STATES},
+                {c->offset + 8, c->offset + 8 + c->size, c->state},
+            };
+            for (int k = 0; k < 2; k++) {
+                for (uint64_t at = spans[k][0]; at < spans[k][1] && at / cell < cells;) {
+                    uint64_t cell_end = (at / cell + 1) * cell;
+                    uint64_t end = cell_end < spans[k][1] ? cell_end : spans[k][1];
+                    cover[at / cell][spans[k][2]] += end - at;
+                    at = end;
+                }
+            }
+        }
+
+        printf("arena %llu, %llu bytes\n", (unsigned long long)a->number,
+               (unsigned long long)a->length);
+        for (size_t c = 0; c < cells; c++) {
+            int best = 0;
+            for (int s = 1; s <= NUM_STATES; s++) {
+                if (cover[c][s] > cover[c][best]) {
+                    best = s;
+                }
+            }
+            putchar(best == NUM_STATES ? HEADER_CHAR : state_chars[best]);
+            if ((c + 1) % width == 0 || c + 1 == cells) {
+                putchar('\n');
+            }
+        }
+        free(cover);
+    }
+}
+
+static void print_sites(const snapshot_t* snap) {
+    tally_t* t;
+    size_t n = tally(snap, 1, &t);
+    if (n == 0) {
+        free(t);
+        return;
+    }
+
+    qsort(t, n, sizeof(tally_t), compare_bytes);
+    printf("\nLive bytes by call site:\n");
+    for (size_t i = 0; i < n && i < TOP_SITES; i++) {
+        printf("  ");
+        print_site(snap, t[i].key);
+        printf(": %llu bytes in %zu blocks\n", (unsigned long long)t[i].bytes, t[i].count);
+    }
+    free(t);
+}
+
+// Walk two sorted tallies side by side and print every key whose live
+// bytes changed, most growth first
+static void print_diff(const snapshot_t* old_snap, const snapshot_t* new_snap, int by_site) {
+    tally_t *a, *b;
+    size_t na = tally(old_snap, by_site, &a);
+    size_t nb = tally(new_snap, by_site, &b);
+
+    // no sites unless the programs were traced
+    if (by_site && na == 0 && nb == 0) {
+        free(a);
+        free(b);
+        return;
+    }
+
+    // the site numbers of two runs need not match, so compare sites by name
+    if (by_site) {
+        for (size_t i = 0; i < na; i++) {
+            uint64_t site = 0;
+            const char* file = old_snap->sites[a[i].key >> 32];
+            for (int s = 1; file && s <= MAX_SITES && !site; s++) {
+                if (new_snap->sites[s] && strcmp(new_snap->sites[s], file) == 0) {
+                    site = s;
+                }
+            }
+            a[i].key = site << 32 | (a[i].key & 0xffffffff);
+        }
+        qsort(a, na, sizeof(tally_t), compare_key);
+    }
+
+    typedef struct {
+        uint64_t key;
+        long long count;
+        long long bytes;
+    } change_t;
+    change_t* changes = malloc((na + nb + 1) * sizeof(change_t));
+    if (!changes) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    size_t n = 0;
+    size_t i = 0, j = 0;
+    while (i < na || j < nb) {
+        change_t c = {0, 0, 0};
+        if (j == nb || (i < na && a[i].key < b[j].key)) {
+            c.key = a[i].key;
+            c.count = -(long long)a[i].count;
+            c.bytes = -(long long)a[i].bytes;
+            i++;
+        } else if (i == na || b[j].key < a[i].key) {
+            c.key = b[j].key;
+            c.count = b[j].count;
+            c.bytes = b[j].bytes;
+            j++;
+        } else {
+            c.key = a[i].key;
+            c.count = (long long)b[j].count - (long long)a[i].count;
+            c.bytes = (long long)b[j].bytes - (long long)a[i].bytes;
+            i++;
+            j++;
+        }
+        if (c.bytes != 0 || c.count != 0) {
+            changes[n++] = c;
+        }
+    }
+
+    // most growth first, a short insertion sort is plenty here
+    for (size_t k = 1; k < n; k++) {
+        change_t c = changes[k];
+        size_t m = k;
+        while (m > 0 && changes[m - 1].bytes < c.bytes) {
+            changes[m] = changes[m - 1];
+            m--;
+        }
+        changes[m] = c;
+    }
+
+    if (by_site) {
+        printf("\nLive bytes by call site, change:\n");
+    } else {
+        printf("\nLive blocks by size, change:\n");
+        printf("%12s %10s %12s\n", "size", "blocks", "bytes");
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (by_site) {
+            printf("  ");
+            print_site(new_snap, changes[k].key);
+            printf(": %+lld bytes, %+lld blocks\n", changes[k].bytes, changes[k].count);
+        } else {
+            printf("%12llu %+10lld %+12lld\n", (unsigned long long)changes[k].key,
+                   changes[k].count, changes[k].bytes);
+        }
+    }
+    if (n == 0) {
+        printf("  none\n");
+    }
+
+    free(changes);
+    free(a);
+    free(b);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-b bytes per character] [-w width] snapshot\n", prog);
+    fprintf(stderr, "       %s -d old-snapshot new-snapshot\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t cell = 64;
+    int width = 64;
+    int diff = 0;
+    int arg_idx = 1;
+
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        if (strcmp(argv[arg_idx], "-d") == 0) {
+            diff = 1;
+            arg_idx++;
+        } else if (strcmp(argv[arg_idx], "-b") == 0 && arg_idx + 1 < argc) {
+            cell = strtoul(argv[arg_idx + 1], NULL, 10);
+            arg_idx += 2;
+        } else if (strcmp(argv[arg_idx], "-w") == 0 && arg_idx + 1 < argc) {
+            width = atoi(argv[arg_idx + 1]);
+            arg_idx += 2;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - arg_idx != (diff ? 2 : 1) || cell == 0 || width < 1) {
+        usage(argv[0]);
+    }
+
+    if (diff) {
+        snapshot_t old_snap, new_snap;
+        if (load_snapshot(argv[arg_idx], &old_snap) < 0 ||
+            load_snapshot(argv[arg_idx + 1], &new_snap) < 0) {
+            return 1;
+        }
+        printf("Old: ");
+        print_summary(&old_snap);
+        printf("New: ");
+        print_summary(&new_snap);
+        print_diff(&old_snap, &new_snap, 0);
+        print_diff(&old_snap, &new_snap, 1);
+        free_snapshot(&old_snap);
+        free_snapshot(&new_snap);
+        return 0;
+    }
+
+    snapshot_t snap;
+    if (load_snapshot(argv[arg_idx], &snap) < 0) {
+        return 1;
+    }
+    print_summary(&snap);
+    print_histogram(&snap);
+    print_map(&snap, cell, width);
+    print_sites(&snap);
+    free_snapshot(&snap);
+    return 0;
+}
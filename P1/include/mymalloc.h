@@ -3,9 +3,110 @@
 
 #define malloc(X) mymalloc(X, __FILE__, __LINE__)
 #define free(X) myfree(X, __FILE__, __LINE__)
+#define realloc(X, Y) myrealloc(X, Y, __FILE__, __LINE__)
+#define calloc(X, Y) mycalloc(X, Y, __FILE__, __LINE__)
+#define aligned_alloc(A, S) myaligned_alloc(A, S, __FILE__, __LINE__)
+#define malloc_batch(N, S, P) mymalloc_batch(N, S, P, __FILE__, __LINE__)
+#define free_batch(P, N) myfree_batch(P, N, __FILE__, __LINE__)
+#define region_create(S) myregion_create(S, __FILE__, __LINE__)
+#define hmalloc(S) myhmalloc(S, __FILE__, __LINE__)
+#define hfree(H) myhfree(H, __FILE__, __LINE__)
 
 void * mymalloc(size_t size, char *file, int line);
 void   myfree(void *ptr, char *file, int line);
+void * myrealloc(void *ptr, size_t size, char *file, int line);
+void * mycalloc(size_t count, size_t size, char *file, int line);
+
+// Block whose address is a multiple of alignment, a power of two. Freed
+// with free() like any other block.
+void * myaligned_alloc(size_t alignment, size_t size, char *file, int line);
+
+// Allocate n blocks of size bytes into ptrs with one lock and one search.
+// Returns n, or 0 if they could not all be allocated, in which case none
+// are.
+size_t mymalloc_batch(size_t n, size_t size, void **ptrs, char *file, int line);
+
+// Free the n blocks in ptrs, checking each one like free() does. NULL
+// entries are skipped. Neighbours freed together are merged once.
+void   myfree_batch(void **ptrs, size_t n, char *file, int line);
+
+// Regions, for objects that all die at the same time. region_alloc
+// bumps a pointer through blocks of block_size bytes (0 for the default)
+// taken from the heap. Nothing is freed one object at a time:
+// region_reset makes all of a region's memory reusable at once and
+// region_destroy gives it back. A region that is never destroyed is
+// reported as a single leak at exit. A region must only be used by one
+// thread at a time.
+typedef struct region region_t;
+
+region_t * myregion_create(size_t block_size, char *file, int line);
+void *     region_alloc(region_t *region, size_t size);
+void       region_reset(region_t *region);
+void       region_destroy(region_t *region);
+
+// Handles, for blocks the allocator may move. hlock returns the block's
+// current address and pins it there until the matching hunlock; locks
+// nest. mymalloc_compact slides every unlocked handle block towards the
+// start of its arena so the free space between them becomes one chunk,
+// and returns the bytes it moved. Addresses from hlock are only good
+// while the handle is locked.
+typedef struct handle handle_t;
+
+handle_t * myhmalloc(size_t size, char *file, int line);
+void *     hlock(handle_t *h);
+void       hunlock(handle_t *h);
+void       myhfree(handle_t *h, char *file, int line);
+size_t     mymalloc_compact(void);
+
+// Placement policies, also selectable with MYMALLOC_POLICY=tlsf, first,
+// next or best in the environment
+#define MYMALLOC_TLSF 0       // segregated fit, constant time (default)
+#define MYMALLOC_FIRST_FIT 1  // lowest address that fits
+#define MYMALLOC_NEXT_FIT 2   // first fit starting where the last one stopped
+#define MYMALLOC_BEST_FIT 3   // smallest chunk that fits
+
+// Set the placement policy, returns the old one or -1 if policy is unknown
+int mymalloc_set_policy(int policy);
+
+// Turn deferred coalescing on or off, also selectable with
+// MYMALLOC_QUICK_LISTS=1 in the environment. Freed chunks of up to 512
+// bytes wait on exact-size quick lists and are merged with their
+// neighbours only when a list fills up or a request finds no fit.
+// Returns the old setting, or -1 in the buddy build, which has none.
+int mymalloc_set_quick_lists(int enabled);
+
+typedef struct {
+    size_t heap_bytes;       // bytes mapped for arenas
+    size_t peak_heap_bytes;  // most bytes ever mapped at once
+    size_t live_bytes;       // bytes in allocated blocks, rounded up to their size
+    size_t live_objects;
+    size_t free_bytes;       // bytes in free chunks
+    size_t free_chunks;
+    size_t largest_free;     // largest request that fits without a new arena
+    double fragmentation;    // 1 - largest_free / free_bytes
+    size_t cached_bytes;     // blocks in thread caches, neither live nor free
+    size_t cached_objects;
+    size_t malloc_calls;     // malloc and calloc
+    size_t realloc_calls;
+    size_t free_calls;
+    size_t failed_calls;     // malloc, calloc or realloc that returned NULL
+    size_t merges;           // free chunks merged with a neighbour
+    double avg_scanned;      // chunks looked at per free chunk search
+} mymalloc_stats_t;
+
+// Fill in stats. This walks the whole heap, so it is not free.
+void mymalloc_stats(mymalloc_stats_t *stats);
+
+// Print the stats to stderr. With MYMALLOC_STATS=1 in the environment
+// this also happens at exit, after a failed allocation, and on the next
+// call after the program gets SIGUSR1.
+void mymalloc_stats_print(void);
+
+// Write every arena and chunk in the heap to path, with the line that
+// allocated each block when MYMALLOC_TRACE is on. The format is in
+// mysnapshot.h; heapmap reads it. Returns 0, or -1 if the file could not
+// be written.
+int mymalloc_snapshot(const char *path);
 
 
 #endif
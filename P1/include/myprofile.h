@@ -0,0 +1,24 @@
+#ifndef _MYPROFILE_H
+#define _MYPROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Call-site profile, kept when MYMALLOC_PROFILE=N is set in the
+// environment. Every call is charged to the file and line the macros
+// pass in: calls, bytes asked for, bytes still live and their peak, and
+// nanoseconds spent in the allocator. Frees are charged to the line that
+// frees, but the bytes they release come off the line that allocated.
+// At exit the N sites that took the most time are printed after the
+// leak report, followed by every site that still has live blocks.
+
+// Used by mymalloc.c. Like trace_event, the profile_* calls are made
+// between trace_lock() and trace_unlock().
+int profile_enabled(void);
+uint64_t profile_clock(void);
+void profile_alloc(void *ptr, size_t size, uint64_t ns, const char *file, int line);
+void profile_free(void *ptr, uint64_t ns, const char *file, int line);
+void profile_realloc(void *ptr, void *old_ptr, size_t size, uint64_t ns, const char *file, int line);
+void profile_report(void);
+
+#endif
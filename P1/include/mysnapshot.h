@@ -0,0 +1,42 @@
+#ifndef _MYSNAPSHOT_H
+#define _MYSNAPSHOT_H
+
+#include <stdint.h>
+
+// Heap snapshot, written by mymalloc_snapshot(path). The file starts with
+// a snapshot_header_t followed by one snapshot_record_t per arena and per
+// chunk, in address order. Each arena's chunks follow its SNAPSHOT_ARENA
+// record. When tracing is on, the first time a source file shows up a
+// SNAPSHOT_SITE record gives it a number and is followed by "line" bytes
+// of file name, as in the trace format.
+
+#define SNAPSHOT_MAGIC 0x534d4d4d  // "MMMS"
+#define SNAPSHOT_VERSION 1
+
+// record types
+#define SNAPSHOT_ARENA 0
+#define SNAPSHOT_CHUNK 1
+#define SNAPSHOT_SITE 2
+
+// chunk states
+#define SNAPSHOT_FREE 0
+#define SNAPSHOT_USED 1
+#define SNAPSHOT_SLAB 2    // a slab page, its objects are not listed
+#define SNAPSHOT_HANDLE 3  // a block compaction may move
+#define SNAPSHOT_QUICK 4   // freed but waiting on a quick list, not merged
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} snapshot_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t state;    // chunk state
+    uint16_t site;    // source file number + 1, 0 when not known
+    uint32_t line;    // source line, or name length for SNAPSHOT_SITE
+    uint64_t offset;  // chunk header from the start of its arena, or arena number
+    uint64_t size;    // chunk payload bytes, or arena bytes
+} snapshot_record_t;
+
+#endif
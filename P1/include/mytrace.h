@@ -0,0 +1,53 @@
+#ifndef _MYTRACE_H
+#define _MYTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation trace, written when MYMALLOC_TRACE=path is set in the
+// environment. The file starts with a trace_header_t followed by one
+// trace_record_t per call. The first time a source file shows up, a
+// TRACE_SITE record gives it a number and is followed by "line" bytes
+// of file name. Pointers are numbered from 1 in the order they are
+// handed out; 0 stands for NULL.
+
+#define TRACE_MAGIC 0x52544d4d  // "MMTR"
+#define TRACE_VERSION 1
+
+#define TRACE_MALLOC 0
+#define TRACE_FREE 1
+#define TRACE_REALLOC 2
+#define TRACE_CALLOC 3
+#define TRACE_SITE 4
+#define TRACE_ALIGNED 5
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} trace_header_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t align_log2; // alignment asked for by TRACE_ALIGNED, 0 otherwise
+    uint16_t site;     // source file number
+    uint32_t line;     // source line, or name length for TRACE_SITE
+    uint32_t id;       // pointer returned, or pointer freed
+    uint32_t old_id;   // pointer passed to realloc
+    uint64_t size;     // bytes asked for, count * size for calloc
+    uint64_t time_ns;  // since the trace started
+} trace_record_t;
+
+// Used by mymalloc.c. While tracing, calls are made between trace_lock()
+// and trace_unlock() so the records come out in the order they happened.
+int trace_enabled(void);
+void trace_lock(void);
+void trace_unlock(void);
+void trace_event(int op, void *ptr, void *old_ptr, size_t size, const char *file, int line);
+void trace_aligned(void *ptr, size_t alignment, size_t size, const char *file, int line);
+
+// File, file number and line that allocated a live pointer, or NULL when
+// tracing is off or the pointer is not known. Used by mymalloc_snapshot
+// between trace_lock() and trace_unlock().
+const char *trace_site(void *ptr, int *site, int *line);
+
+#endif
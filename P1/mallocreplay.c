@@ -0,0 +1,226 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mymalloc.h"
+#include "mytrace.h"
+
+// One call from the trace, with the site records taken out
+typedef struct {
+    uint8_t op;
+    uint8_t align_log2;
+    uint32_t id;
+    uint32_t old_id;
+    size_t size;
+} replay_op_t;
+
+// Allocator being replayed against. The libc functions are named without
+// a following '(' so the mymalloc.h macros are not expanded.
+typedef struct {
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+    void* (*resize)(void*, size_t);
+    void* (*zalloc)(size_t, size_t);
+    void* (*align)(size_t, size_t);
+} allocator_t;
+
+static void* my_alloc(size_t size) { return malloc(size); }
+static void my_release(void* ptr) { free(ptr); }
+static void* my_resize(void* ptr, size_t size) { return realloc(ptr, size); }
+static void* my_zalloc(size_t count, size_t size) { return calloc(count, size); }
+static void* my_align(size_t alignment, size_t size) { return aligned_alloc(alignment, size); }
+
+static void* libc_align(size_t alignment, size_t size) {
+    void* ptr;
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+}
+
+static const allocator_t mymalloc_allocator = {my_alloc, my_release, my_resize, my_zalloc, my_align};
+static const allocator_t libc_allocator = {malloc, free, realloc, calloc, libc_align};
+
+// The trace itself is kept in the libc heap so it does not disturb the
+// allocator being measured
+static replay_op_t* ops = NULL;
+static size_t op_count = 0;
+static uint32_t max_id = 0;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Read a trace file into ops, returns -1 if it is not a valid trace
+static int load_trace(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not an allocation trace\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    trace_record_t rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.op == TRACE_SITE) {
+            // the file name is not needed to replay
+            fseek(fp, rec.line, SEEK_CUR);
+            continue;
+        }
+        if (rec.op > TRACE_ALIGNED) {
+            fprintf(stderr, "%s: bad record %zu\n", path, op_count);
+            fclose(fp);
+            return -1;
+        }
+
+        if (op_count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            ops = (realloc)(ops, capacity * sizeof(replay_op_t));
+            if (!ops) {
+                fprintf(stderr, "Out of memory reading %s\n", path);
+                exit(1);
+            }
+        }
+
+        replay_op_t* op = &ops[op_count++];
+        op->op = rec.op;
+        op->align_log2 = rec.align_log2;
+        op->id = rec.id;
+        op->old_id = rec.old_id;
+        op->size = rec.size;
+        if (rec.id > max_id) {
+            max_id = rec.id;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// Replay every call once, returns the time spent in nanoseconds
+static double replay(const allocator_t* a, void** ptrs) {
+    double start = now_ns();
+
+    for (size_t i = 0; i < op_count; i++) {
+        replay_op_t* op = &ops[i];
+
+        switch (op->op) {
+            case TRACE_MALLOC:
+                if (op->id) {
+                    ptrs[op->id] = a->alloc(op->size);
+                }
+                break;
+            case TRACE_CALLOC:
+                if (op->id) {
+                    ptrs[op->id] = a->zalloc(1, op->size);
+                }
+                break;
+            case TRACE_ALIGNED:
+                if (op->id) {
+                    ptrs[op->id] = a->align((size_t)1 << op->align_log2, op->size);
+                }
+                break;
+            case TRACE_FREE:
+                a->release(ptrs[op->id]);
+                ptrs[op->id] = NULL;
+                break;
+            case TRACE_REALLOC:
+                if (op->size == 0) {
+                    // realloc(p, 0) freed p
+                    a->release(ptrs[op->old_id]);
+                    ptrs[op->old_id] = NULL;
+                } else if (op->id) {
+                    ptrs[op->id] = a->resize(ptrs[op->old_id], op->size);
+                    if (op->old_id) {
+                        ptrs[op->old_id] = NULL;
+                    }
+                }
+                break;
+        }
+
+        if (op->id && op->op != TRACE_FREE && op->size > 0 && !ptrs[op->id]) {
+            fprintf(stderr, "Replay failed: call %zu could not allocate %zu bytes\n",
+                    i, op->size);
+            exit(1);
+        }
+    }
+
+    return now_ns() - start;
+}
+
+int main(int argc, char** argv) {
+    const allocator_t* a = &mymalloc_allocator;
+    const char* name = "mymalloc";
+    int runs = 1;
+    int arg_idx = 1;
+
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        if (strcmp(argv[arg_idx], "-l") == 0) {
+            a = &libc_allocator;
+            name = "libc";
+            arg_idx++;
+        } else if (strcmp(argv[arg_idx], "-r") == 0 && arg_idx + 1 < argc) {
+            runs = atoi(argv[arg_idx + 1]);
+            arg_idx += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (arg_idx != argc - 1 || runs < 1) {
+        fprintf(stderr, "Usage: %s [-l] [-r runs] trace\n", argv[0]);
+        return 1;
+    }
+
+    if (load_trace(argv[arg_idx]) < 0) {
+        return 1;
+    }
+
+    void** ptrs = (calloc)((size_t)max_id + 1, sizeof(void*));
+    if (!ptrs) {
+        fprintf(stderr, "Out of memory for %u pointers\n", max_id);
+        return 1;
+    }
+
+    double total = 0;
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        double elapsed = replay(a, ptrs);
+        total += elapsed;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+
+        // free whatever the traced program leaked, untimed
+        for (uint32_t id = 1; id <= max_id; id++) {
+            if (ptrs[id]) {
+                a->release(ptrs[id]);
+                ptrs[id] = NULL;
+            }
+        }
+    }
+
+    double avg = total / runs;
+    printf("Replayed %zu calls with %s, %d run%s\n", op_count, name, runs, runs == 1 ? "" : "s");
+    printf("Average time: %.3f microseconds (best %.3f)\n", avg / 1000, best / 1000);
+    printf("Per call: %.1f nanoseconds, %.0f calls/sec\n",
+           op_count ? avg / op_count : 0, op_count ? op_count * 1e9 / avg : 0);
+
+    if (a == &mymalloc_allocator) {
+        mymalloc_stats_t stats;
+        mymalloc_stats(&stats);
+        printf("Peak heap: %zu bytes\n", stats.peak_heap_bytes);
+    }
+
+    (free)(ptrs);
+    (free)(ops);
+    return 0;
+}
@@ -1,69 +1,226 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <time.h>
 #include "mymalloc.h"
 
 #define NUM_RUNS 50
+#define WARMUP_RUNS 5
 #define ALLOC_COUNT 120
+#define MAX_COUNT 10000
+#define NUM_TASKS 11
+#define POW2_SLOTS 32
 
-// Get current time
-static double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000L + tv.tv_usec;
+// One allocator under test. The mymalloc ones go through the macros in
+// mymalloc.h; the libc baseline names malloc/free/realloc without a
+// following '(' so the macros are not expanded and we get the real ones.
+typedef struct {
+    const char* name;
+    int policy; // -1 for libc
+    int quick;  // deferred coalescing with quick lists
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+    void* (*resize)(void*, size_t);
+} allocator_t;
+
+static void* my_alloc(size_t size) { return malloc(size); }
+static void my_release(void* ptr) { free(ptr); }
+static void* my_resize(void* ptr, size_t size) { return realloc(ptr, size); }
+
+// Built with -DBUDDY (memgrind-buddy) there are no placement policies
+static const allocator_t allocators[] = {
+#ifdef BUDDY
+    {"buddy", MYMALLOC_TLSF, 0, my_alloc, my_release, my_resize},
+#else
+    {"tlsf", MYMALLOC_TLSF, 0, my_alloc, my_release, my_resize},
+    {"tlsf-quick", MYMALLOC_TLSF, 1, my_alloc, my_release, my_resize},
+    {"first-fit", MYMALLOC_FIRST_FIT, 0, my_alloc, my_release, my_resize},
+    {"next-fit", MYMALLOC_NEXT_FIT, 0, my_alloc, my_release, my_resize},
+    {"best-fit", MYMALLOC_BEST_FIT, 0, my_alloc, my_release, my_resize},
+#endif
+    {"libc", -1, 0, malloc, free, realloc},
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+// Results for one task, measured over the timed runs only
+typedef struct {
+    double avg_us;      // wall time per run
+    double ops_per_sec; // allocator calls per second of time spent inside them
+    long p50;           // per-call latency in nanoseconds
+    long p99;
+    long max;
+} task_result_t;
+
+// What one allocator run sends back to the parent
+typedef struct {
+    task_result_t tasks[NUM_TASKS];
+    long copy_avoided;   // per run of Task 5
+    size_t peak_heap;    // 0 for libc
+    size_t largest_free; // at the fullest point of any task, 0 for libc
+    double internal_frag; // Task 7 bytes handed out but not asked for, 0 for libc
+} run_result_t;
+
+// benchmark settings, set from the command line
+static int num_runs = NUM_RUNS;
+static int warmup_runs = WARMUP_RUNS;
+static int count = ALLOC_COUNT;
+static size_t obj_size = 1;
+
+// state of the run in progress
+static const allocator_t* alloc = NULL;
+static long* samples = NULL;
+static size_t num_samples = 0;
+static size_t max_samples = 0;
+static int recording = 0;
+
+// bytes Task 5 did not have to copy because realloc stayed in place
+static long copy_avoided = 0;
+
+// smallest "largest free block" seen while a task held the most memory
+static size_t worst_largest_free = (size_t)-1;
+
+// bytes Task 7 asked for and bytes it was handed, at its fullest point
+static size_t pow2_requested = 0;
+static size_t pow2_held = 0;
+
+// time the timed runs spent in the heap walks of the samples below,
+// which only mymalloc does, so run_task takes it back out of avg_us
+static long sampling_ns = 0;
+
+// Monotonic time in nanoseconds
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Keep one latency sample. The sample buffer lives in the libc heap so
+// it does not disturb the allocator being measured.
+static void record(long ns) {
+    if (!recording) {
+        return;
+    }
+    if (num_samples == max_samples) {
+        max_samples = max_samples ? max_samples * 2 : 4096;
+        samples = (realloc)(samples, max_samples * sizeof(long));
+        if (samples == NULL) {
+            printf("Out of memory for samples\n");
+            exit(1);
+        }
+    }
+    samples[num_samples++] = ns;
 }
 
-// Task 1: malloc and free 1-byte objects 120 times
+static void* bench_malloc(size_t size) {
+    long start = now_ns();
+    void* ptr = alloc->alloc(size);
+    record(now_ns() - start);
+    return ptr;
+}
+
+static void bench_free(void* ptr) {
+    long start = now_ns();
+    alloc->release(ptr);
+    record(now_ns() - start);
+}
+
+static void* bench_realloc(void* ptr, size_t size) {
+    long start = now_ns();
+    void* new_ptr = alloc->resize(ptr, size);
+    record(now_ns() - start);
+    return new_ptr;
+}
+
+// Called by the tasks at the point where they hold the most memory
+static void sample_heap() {
+    if (alloc->policy < 0) {
+        return;
+    }
+
+    long start = now_ns();
+    mymalloc_stats_t stats;
+    mymalloc_stats(&stats);
+    if (recording) {
+        sampling_ns += now_ns() - start;
+    }
+
+    if (stats.largest_free < worst_largest_free) {
+        worst_largest_free = stats.largest_free;
+    }
+}
+
+// Called by Task 7 when every slot is full. The heap is empty between
+// tasks, so all live bytes are Task 7's.
+static void sample_pow2(size_t requested) {
+    if (alloc->policy < 0 || !recording) {
+        return;
+    }
+
+    long start = now_ns();
+    mymalloc_stats_t stats;
+    mymalloc_stats(&stats);
+    sampling_ns += now_ns() - start;
+    pow2_requested += requested;
+    pow2_held += stats.live_bytes;
+}
+
+// Task 1: malloc and free one object, count times
 static void task1() {
-    for (int i = 0; i < ALLOC_COUNT; i++) {
-        char* ptr = malloc(1);
+    for (int i = 0; i < count; i++) {
+        char* ptr = bench_malloc(obj_size);
         if (ptr == NULL) {
             printf("Task 1 failed at %d\n", i);
             exit(1);
         }
-        free(ptr);
+        if (i == 0) {
+            sample_heap();
+        }
+        bench_free(ptr);
     }
 }
 
-// Task 2: allocate 120 objects then free them all
+// Task 2: allocate count objects then free them all
 static void task2() {
-    char* ptrs[ALLOC_COUNT];
-    
+    char* ptrs[MAX_COUNT];
+
     // allocate
-    for (int i = 0; i < ALLOC_COUNT; i++) {
-        ptrs[i] = malloc(1);
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = bench_malloc(obj_size);
         if (ptrs[i] == NULL) {
             printf("Task 2 failed at %d\n", i);
             exit(1);
         }
     }
-    
+    sample_heap();
+
     // free
-    for (int i = 0; i < ALLOC_COUNT; i++) {
-        free(ptrs[i]);
+    for (int i = 0; i < count; i++) {
+        bench_free(ptrs[i]);
     }
 }
 
 // Task 3: random allocation/deallocation
 static void task3() {
-    char* ptrs[ALLOC_COUNT];
+    char* ptrs[MAX_COUNT];
     int allocated = 0;
     int total = 0;
-    
-    for (int i = 0; i < ALLOC_COUNT; i++) {
+
+    for (int i = 0; i < count; i++) {
         ptrs[i] = NULL;
     }
-    
-    while (total < ALLOC_COUNT) {
+
+    while (total < count) {
         int choice = rand() % 2;
-        
+
         if (choice == 0) {
             // allocate if we have space
-            if (allocated < ALLOC_COUNT) {
-                for (int i = 0; i < ALLOC_COUNT; i++) {
+            if (allocated < count) {
+                for (int i = 0; i < count; i++) {
                     if (ptrs[i] == NULL) {
-                        ptrs[i] = malloc(1);
+                        ptrs[i] = bench_malloc(obj_size);
                         if (ptrs[i] == NULL) {
                             printf("Task 3 malloc failed\n");
                             exit(1);
@@ -77,11 +234,11 @@ static void task3() {
         } else {
             // deallocate if we have objects
             if (allocated > 0) {
-                int start = rand() % ALLOC_COUNT;
-                for (int i = 0; i < ALLOC_COUNT; i++) {
-                    int idx = (start + i) % ALLOC_COUNT;
+                int start = rand() % count;
+                for (int i = 0; i < count; i++) {
+                    int idx = (start + i) % count;
                     if (ptrs[idx] != NULL) {
-                        free(ptrs[idx]);
+                        bench_free(ptrs[idx]);
                         ptrs[idx] = NULL;
                         allocated--;
                         break;
@@ -90,11 +247,13 @@ static void task3() {
             }
         }
     }
-    
+
+    sample_heap();
+
     // clean up remaining
-    for (int i = 0; i < ALLOC_COUNT; i++) {
+    for (int i = 0; i < count; i++) {
         if (ptrs[i] != NULL) {
-            free(ptrs[i]);
+            bench_free(ptrs[i]);
         }
     }
 }
@@ -105,12 +264,12 @@ static void task4() {
         int data;
         struct node* next;
     } node_t;
-    
+
     node_t* head = NULL;
-    
-    // create list with 60 nodes
-    for (int i = 0; i < 60; i++) {
-        node_t* new_node = malloc(sizeof(node_t));
+
+    // create list with count / 2 nodes
+    for (int i = 0; i < count / 2; i++) {
+        node_t* new_node = bench_malloc(sizeof(node_t));
         if (new_node == NULL) {
             printf("Task 4 malloc failed at %d\n", i);
             exit(1);
@@ -119,12 +278,12 @@ static void task4() {
         new_node->next = head;
         head = new_node;
     }
-    
+
     // remove every other node
     node_t* curr = head;
     node_t* prev = NULL;
     int cnt = 0;
-    
+
     while (curr != NULL) {
         if (cnt % 2 == 1) {
             if (prev != NULL) {
@@ -134,115 +293,396 @@ static void task4() {
             }
             node_t* temp = curr;
             curr = curr->next;
-            free(temp);
+            bench_free(temp);
         } else {
             prev = curr;
             curr = curr->next;
         }
         cnt++;
     }
-    
+
+    sample_heap();
+
     // free remaining
     while (head != NULL) {
         node_t* temp = head;
         head = head->next;
-        free(temp);
+        bench_free(temp);
     }
 }
 
-// Task 5: dynamic array resizing
+// Task 5: dynamic array resizing with realloc
 static void task5() {
     int size = 10;
     int max_ops = 100;
-    
-    int* array = malloc(size * sizeof(int));
+
+    int* array = bench_malloc(size * sizeof(int));
     if (array == NULL) {
         printf("Task 5 initial malloc failed\n");
         exit(1);
     }
-    
+
     int curr_size = size;
-    
+
     // fill initial array
     for (int i = 0; i < size; i++) {
         array[i] = i;
     }
-    
+
     // do resize operations
     for (int op = 0; op < max_ops; op++) {
         int operation = rand() % 3;
-        
+
         if (operation == 0 && curr_size > 5) {
             // shrink
             int new_size = curr_size / 2;
-            int* new_array = malloc(new_size * sizeof(int));
+            int* new_array = bench_realloc(array, new_size * sizeof(int));
             if (new_array == NULL) {
                 printf("Task 5 shrink failed\n");
                 exit(1);
             }
-            
-            for (int i = 0; i < new_size; i++) {
-                new_array[i] = array[i];
+
+            if (new_array == array && recording) {
+                copy_avoided += new_size * sizeof(int);
             }
-            
-            free(array);
+
             array = new_array;
             curr_size = new_size;
         } else if (operation == 1 && curr_size < 80) {
             // grow
             int new_size = curr_size * 2;
-            int* new_array = malloc(new_size * sizeof(int));
+            int* new_array = bench_realloc(array, new_size * sizeof(int));
             if (new_array == NULL) {
                 printf("Task 5 grow failed\n");
                 exit(1);
             }
-            
-            for (int i = 0; i < curr_size; i++) {
-                new_array[i] = array[i];
+
+            if (new_array == array && recording) {
+                copy_avoided += curr_size * sizeof(int);
             }
-            
+
             for (int i = curr_size; i < new_size; i++) {
                 new_array[i] = i;
             }
-            
-            free(array);
+
             array = new_array;
             curr_size = new_size;
         }
     }
-    
-    free(array);
-}
-
-int main() {
-    printf("Starting stress test with %d runs\n", NUM_RUNS);
-    
-    void (*tasks[])(void) = {task1, task2, task3, task4, task5};
-    const char* names[] = {
-        "Task 1: malloc/free cycles",
-        "Task 2: bulk alloc/free", 
-        "Task 3: random ops",
-        "Task 4: linked list",
-        "Task 5: dynamic arrays"
-    };
-    
-    srand(time(NULL));
-    long total = 0; // not sure if this is needed but someone said to include it
-    for (int i = 0; i < 5; i++) {
-        printf("\n%s:\n", names[i]);
-        
-        double start = get_time();
-        
-        for (int run = 0; run < NUM_RUNS; run++) {
-            tasks[i]();
-        }
-        
-        double end = get_time();
-        double avg = (end - start) / NUM_RUNS;
-        total += avg; 
-        printf("Average time: %.3f microseconds\n", avg);
-    }
-    printf("\nAverage workload time per run: %ld microseconds\n", total / 5);
-    printf("\nMemgrind done!\n");
+
+    sample_heap();
+    bench_free(array);
+}
+
+// Task 6: time free() with a growing number of live objects. Odd slots
+// are freed first so each free has allocated neighbours, then the even
+// slots merge with a free chunk on both sides. Only the frees are timed.
+static void free_latency(int live) {
+    char* ptrs[MAX_COUNT];
+
+    for (int i = 0; i < live; i++) {
+        ptrs[i] = alloc->alloc(obj_size);
+        if (ptrs[i] == NULL) {
+            printf("Task 6 malloc failed at %d\n", i);
+            exit(1);
+        }
+    }
+
+    for (int i = 1; i < live; i += 2) {
+        bench_free(ptrs[i]);
+    }
+    for (int i = 0; i < live; i += 2) {
+        bench_free(ptrs[i]);
+    }
+}
+
+// Task 7: power-of-two buffers from 16 to 1024 bytes. Fill every slot,
+// then replace count random buffers with new ones.
+static void task7() {
+    char* ptrs[POW2_SLOTS];
+    size_t requested = 0;
+
+    for (int i = 0; i < POW2_SLOTS; i++) {
+        size_t size = (size_t)16 << (rand() % 7);
+        ptrs[i] = bench_malloc(size);
+        if (ptrs[i] == NULL) {
+            printf("Task 7 malloc failed at %d\n", i);
+            exit(1);
+        }
+        requested += size;
+    }
+
+    sample_heap();
+    sample_pow2(requested);
+
+    for (int i = 0; i < count; i++) {
+        int slot = rand() % POW2_SLOTS;
+        bench_free(ptrs[slot]);
+        ptrs[slot] = bench_malloc((size_t)16 << (rand() % 7));
+        if (ptrs[slot] == NULL) {
+            printf("Task 7 malloc failed at %d\n", i);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < POW2_SLOTS; i++) {
+        bench_free(ptrs[i]);
+    }
+}
+
+static void task6_8() { free_latency(8 < count ? 8 : count); }
+static void task6_16() { free_latency(16 < count ? 16 : count); }
+static void task6_32() { free_latency(32 < count ? 32 : count); }
+static void task6_64() { free_latency(64 < count ? 64 : count); }
+static void task6_all() { free_latency(count); }
+
+static void (*tasks[NUM_TASKS])(void) = {
+    task1, task2, task3, task4, task5,
+    task6_8, task6_16, task6_32, task6_64, task6_all, task7
+};
+
+static const char* task_names[NUM_TASKS] = {
+    "Task 1: malloc/free cycles",
+    "Task 2: bulk alloc/free",
+    "Task 3: random ops",
+    "Task 4: linked list",
+    "Task 5: dynamic arrays",
+    "Task 6: free, 8 live",
+    "Task 6: free, 16 live",
+    "Task 6: free, 32 live",
+    "Task 6: free, 64 live",
+    "Task 6: free, all live",
+    "Task 7: power-of-two mix"
+};
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the sorted samples
+static long percentile(int pct) {
+    if (num_samples == 0) {
+        return 0;
+    }
+    return samples[(num_samples - 1) * pct / 100];
+}
+
+// Warm up, then time num_runs runs of one task
+static void run_task(int t, task_result_t* result) {
+    recording = 0;
+    for (int run = 0; run < warmup_runs; run++) {
+        tasks[t]();
+    }
+
+    num_samples = 0;
+    sampling_ns = 0;
+    recording = 1;
+    long start = now_ns();
+    for (int run = 0; run < num_runs; run++) {
+        tasks[t]();
+    }
+    long elapsed = now_ns() - start - sampling_ns;
+    recording = 0;
+
+    long in_allocator = 0;
+    for (size_t i = 0; i < num_samples; i++) {
+        in_allocator += samples[i];
+    }
+    qsort(samples, num_samples, sizeof(long), compare_long);
+
+    result->avg_us = elapsed / 1000.0 / num_runs;
+    result->ops_per_sec = in_allocator > 0 ? num_samples * 1e9 / in_allocator : 0;
+    result->p50 = percentile(50);
+    result->p99 = percentile(99);
+    result->max = num_samples > 0 ? samples[num_samples - 1] : 0;
+}
+
+// Run every task with one allocator and fill in result
+static void run_allocator(const allocator_t* a, unsigned int seed, run_result_t* result) {
+    alloc = a;
+    if (a->policy >= 0) {
+        mymalloc_set_policy(a->policy);
+        mymalloc_set_quick_lists(a->quick);
+    }
+    srand(seed);
+
+    for (int t = 0; t < NUM_TASKS; t++) {
+        run_task(t, &result->tasks[t]);
+    }
+    result->copy_avoided = copy_avoided / num_runs;
+
+    result->peak_heap = 0;
+    result->largest_free = 0;
+    result->internal_frag = 0;
+    if (a->policy >= 0) {
+        mymalloc_stats_t stats;
+        mymalloc_stats(&stats);
+        result->peak_heap = stats.peak_heap_bytes;
+        result->largest_free = worst_largest_free;
+        if (pow2_held > 0) {
+            result->internal_frag = 1 - (double)pow2_requested / pow2_held;
+        }
+    }
+}
+
+static void print_text(const run_result_t* results) {
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        printf("\n=== %s ===\n", allocators[a].name);
+        printf("%-26s %10s %12s %8s %8s %9s\n",
+               "task", "us/run", "ops/sec", "p50 ns", "p99 ns", "max ns");
+        for (int t = 0; t < NUM_TASKS; t++) {
+            const task_result_t* r = &results[a].tasks[t];
+            printf("%-26s %10.3f %12.0f %8ld %8ld %9ld\n",
+                   task_names[t], r->avg_us, r->ops_per_sec, r->p50, r->p99, r->max);
+        }
+        printf("Task 5 copy bytes avoided per run: %ld\n", results[a].copy_avoided);
+    }
+
+    printf("\nAllocator comparison:\n");
+    printf("%-10s %14s %12s %14s %12s %12s\n", "allocator", "avg us (1-5)", "peak heap",
+           "largest free", "pow2 ops/s", "pow2 waste");
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        double total = 0;
+        for (int t = 0; t < 5; t++) {
+            total += results[a].tasks[t].avg_us;
+        }
+        double pow2_ops = results[a].tasks[NUM_TASKS - 1].ops_per_sec;
+        if (allocators[a].policy < 0) {
+            printf("%-10s %14.3f %12s %14s %12.0f %12s\n", allocators[a].name, total / 5,
+                   "-", "-", pow2_ops, "-");
+        } else {
+            printf("%-10s %14.3f %12zu %14zu %12.0f %11.1f%%\n", allocators[a].name, total / 5,
+                   results[a].peak_heap, results[a].largest_free, pow2_ops,
+                   results[a].internal_frag * 100);
+        }
+    }
+}
+
+static void print_csv(const run_result_t* results) {
+    printf("allocator,task,us_per_run,ops_per_sec,p50_ns,p99_ns,max_ns,peak_heap,largest_free,internal_frag\n");
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        for (int t = 0; t < NUM_TASKS; t++) {
+            const task_result_t* r = &results[a].tasks[t];
+            // task names have commas in them, so that field is quoted
+            printf("%s,\"%s\",%.3f,%.0f,%ld,%ld,%ld,", allocators[a].name, task_names[t],
+                   r->avg_us, r->ops_per_sec, r->p50, r->p99, r->max);
+            if (allocators[a].policy < 0) {
+                printf(",,\n");
+            } else {
+                printf("%zu,%zu,%.4f\n", results[a].peak_heap, results[a].largest_free,
+                       results[a].internal_frag);
+            }
+        }
+    }
+}
+
+static void print_json(const run_result_t* results, unsigned int seed) {
+    printf("{\n  \"runs\": %d, \"warmup\": %d, \"count\": %d, \"size\": %zu, \"seed\": %u,\n",
+           num_runs, warmup_runs, count, obj_size, seed);
+    printf("  \"allocators\": [\n");
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        printf("    {\"name\": \"%s\", ", allocators[a].name);
+        if (allocators[a].policy < 0) {
+            printf("\"peak_heap\": null, \"largest_free\": null, \"internal_frag\": null, ");
+        } else {
+            printf("\"peak_heap\": %zu, \"largest_free\": %zu, \"internal_frag\": %.4f, ",
+                   results[a].peak_heap, results[a].largest_free, results[a].internal_frag);
+        }
+        printf("\"copy_avoided\": %ld, \"tasks\": [\n", results[a].copy_avoided);
+        for (int t = 0; t < NUM_TASKS; t++) {
+            const task_result_t* r = &results[a].tasks[t];
+            printf("      {\"task\": \"%s\", \"us_per_run\": %.3f, \"ops_per_sec\": %.0f, "
+                   "\"p50_ns\": %ld, \"p99_ns\": %ld, \"max_ns\": %ld}%s\n",
+                   task_names[t], r->avg_us, r->ops_per_sec, r->p50, r->p99, r->max,
+                   t + 1 < NUM_TASKS ? "," : "");
+        }
+        printf("    ]}%s\n", a + 1 < NUM_ALLOCATORS ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-r runs] [-w warmup] [-n count] [-s size] [-S seed] [-f text|csv|json]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    unsigned int seed = time(NULL);
+    const char* format = "text";
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+            usage(argv[0]);
+        }
+        const char* value = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 'r': num_runs = atoi(value); break;
+            case 'w': warmup_runs = atoi(value); break;
+            case 'n': count = atoi(value); break;
+            case 's': obj_size = strtoul(value, NULL, 10); break;
+            case 'S': seed = strtoul(value, NULL, 10); break;
+            case 'f': format = value; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (num_runs < 1 || warmup_runs < 0 || count < 1 || count > MAX_COUNT || obj_size < 1) {
+        usage(argv[0]);
+    }
+    if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+        usage(argv[0]);
+    }
+
+    int text = strcmp(format, "text") == 0;
+    if (text) {
+        printf("Starting stress test with %d runs (%d warm-up), %d objects, object size %zu, seed %u\n",
+               num_runs, warmup_runs, count, obj_size, seed);
+    }
+
+    // every allocator runs in its own process so it starts from an empty
+    // heap, with the same random sequence
+    run_result_t results[NUM_ALLOCATORS];
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        fflush(stdout);
+
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+
+        if (pid == 0) {
+            close(fds[0]);
+            run_allocator(&allocators[a], seed, &results[a]);
+            if (write(fds[1], &results[a], sizeof(results[a])) != sizeof(results[a])) {
+                exit(1);
+            }
+            exit(0);
+        }
+
+        close(fds[1]);
+        if (read(fds[0], &results[a], sizeof(results[a])) != sizeof(results[a])) {
+            fprintf(stderr, "Allocator %s failed\n", allocators[a].name);
+            return 1;
+        }
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+    }
+
+    if (text) {
+        print_text(results);
+        printf("\nMemgrind done!\n");
+    } else if (strcmp(format, "csv") == 0) {
+        print_csv(results);
+    } else {
+        print_json(results, seed);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,557 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "mymalloc.h"
+
+#define NUM_RUNS 200
+#define WARMUP_RUNS 5
+#define ALLOC_COUNT 120
+#define MAX_COUNT 10000
+#define MAX_THREADS 64
+#define NUM_TASKS 5
+#define QUEUE_SIZE 1024  // frees in flight from one thread to its partner
+
+// Build with -DTHREADSAFE so mymalloc can be shared between threads.
+// Every task of memgrind runs on N threads at once, each thread with its
+// own data. In the private pattern a thread frees what it allocated; in
+// the cross pattern threads are paired and every free is handed to the
+// partner, which frees it from its own thread.
+
+// One allocator under test. The mymalloc one goes through the macros in
+// mymalloc.h; the libc baseline names malloc/free/realloc without a
+// following '(' so the macros are not expanded and we get the real ones.
+typedef struct {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+    void* (*resize)(void*, size_t);
+} allocator_t;
+
+static void* my_alloc(size_t size) { return malloc(size); }
+static void my_release(void* ptr) { free(ptr); }
+static void* my_resize(void* ptr, size_t size) { return realloc(ptr, size); }
+
+static const allocator_t allocators[] = {
+    {"mymalloc", my_alloc, my_release, my_resize},
+    {"libc", malloc, free, realloc},
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+static const char* pattern_names[] = {"private", "cross"};
+
+// One thread of a run. The queue holds blocks its partner allocated and
+// wants freed; only the partner writes tail and only this thread writes
+// head.
+typedef struct worker {
+    const allocator_t* alloc;
+    int task;
+    int cross;
+    unsigned int seed;
+    struct worker* partner;
+    void* queue[QUEUE_SIZE];
+    size_t head;
+    size_t tail;
+    int phase;        // last phase whose frees have all been sent
+    int recording;
+    long* samples;    // per-call latency in nanoseconds
+    size_t num_samples;
+    size_t max_samples;
+    long start_ns;
+    long end_ns;
+    pthread_t thread;
+} worker_t;
+
+// Results for one task at one thread count
+typedef struct {
+    double ops_per_sec;  // allocator calls per second of wall time
+    long p50;            // per-call latency in nanoseconds
+    long p99;
+    long p999;
+    long max;
+} mt_result_t;
+
+// benchmark settings, set from the command line
+static int num_runs = NUM_RUNS;
+static int warmup_runs = WARMUP_RUNS;
+static int count = ALLOC_COUNT;
+static size_t obj_size = 1;
+static int max_threads = 8;
+
+static pthread_barrier_t start_barrier;
+
+// Monotonic time in nanoseconds
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Keep one latency sample. The sample buffer lives in the libc heap so
+// it does not disturb the allocator being measured.
+static void record(worker_t* w, long ns) {
+    if (!w->recording) {
+        return;
+    }
+    if (w->num_samples == w->max_samples) {
+        w->max_samples = w->max_samples ? w->max_samples * 2 : 4096;
+        w->samples = (realloc)(w->samples, w->max_samples * sizeof(long));
+        if (w->samples == NULL) {
+            printf("Out of memory for samples\n");
+            exit(1);
+        }
+    }
+    w->samples[w->num_samples++] = ns;
+}
+
+// Free everything the partner has handed over so far
+static void drain(worker_t* w) {
+    size_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+    size_t head = w->head;
+
+    while (head != tail) {
+        long start = now_ns();
+        w->alloc->release(w->queue[head % QUEUE_SIZE]);
+        record(w, now_ns() - start);
+        head++;
+    }
+    __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+}
+
+// Hand a block to the partner to free. While its queue is full, free
+// what the partner handed us, so two threads waiting on each other still
+// make progress.
+static void send(worker_t* w, void* ptr) {
+    worker_t* p = w->partner;
+
+    while (p->tail - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+        drain(w);
+        sched_yield();
+    }
+    p->queue[p->tail % QUEUE_SIZE] = ptr;
+    __atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Tell the partner this thread is done sending for a phase, then free
+// what it sends until it says the same
+static void finish(worker_t* w, int phase) {
+    __atomic_store_n(&w->phase, phase, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&w->partner->phase, __ATOMIC_ACQUIRE) < phase) {
+        drain(w);
+        sched_yield();
+    }
+    drain(w);
+}
+
+static void* bench_malloc(worker_t* w, size_t size) {
+    long start = now_ns();
+    void* ptr = w->alloc->alloc(size);
+    record(w, now_ns() - start);
+    return ptr;
+}
+
+static void bench_free(worker_t* w, void* ptr) {
+    if (w->cross) {
+        send(w, ptr);
+        drain(w);
+        return;
+    }
+
+    long start = now_ns();
+    w->alloc->release(ptr);
+    record(w, now_ns() - start);
+}
+
+static void* bench_realloc(worker_t* w, void* ptr, size_t size) {
+    long start = now_ns();
+    void* new_ptr = w->alloc->resize(ptr, size);
+    record(w, now_ns() - start);
+    return new_ptr;
+}
+
+// Task 1: malloc and free one object, count times
+static void task1(worker_t* w) {
+    for (int i = 0; i < count; i++) {
+        char* ptr = bench_malloc(w, obj_size);
+        if (ptr == NULL) {
+            printf("Task 1 failed at %d\n", i);
+            exit(1);
+        }
+        ptr[0] = (char)i;
+        bench_free(w, ptr);
+    }
+}
+
+// Task 2: allocate count objects then free them all
+static void task2(worker_t* w) {
+    char* ptrs[MAX_COUNT];
+
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = bench_malloc(w, obj_size);
+        if (ptrs[i] == NULL) {
+            printf("Task 2 failed at %d\n", i);
+            exit(1);
+        }
+        ptrs[i][0] = (char)i;
+    }
+
+    for (int i = 0; i < count; i++) {
+        bench_free(w, ptrs[i]);
+    }
+}
+
+// Task 3: random allocation/deallocation
+static void task3(worker_t* w) {
+    char* ptrs[MAX_COUNT];
+    int allocated = 0;
+    int total = 0;
+
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = NULL;
+    }
+
+    while (total < count) {
+        if (rand_r(&w->seed) % 2 == 0) {
+            // allocate in the first empty slot
+            for (int i = 0; i < count; i++) {
+                if (ptrs[i] == NULL) {
+                    ptrs[i] = bench_malloc(w, obj_size);
+                    if (ptrs[i] == NULL) {
+                        printf("Task 3 malloc failed\n");
+                        exit(1);
+                    }
+                    allocated++;
+                    total++;
+                    break;
+                }
+            }
+        } else if (allocated > 0) {
+            // free the first object after a random slot
+            int start = rand_r(&w->seed) % count;
+            for (int i = 0; i < count; i++) {
+                int idx = (start + i) % count;
+                if (ptrs[idx] != NULL) {
+                    bench_free(w, ptrs[idx]);
+                    ptrs[idx] = NULL;
+                    allocated--;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (ptrs[i] != NULL) {
+            bench_free(w, ptrs[i]);
+        }
+    }
+}
+
+// Task 4: build a linked list, unlink every other node, free the rest
+static void task4(worker_t* w) {
+    typedef struct node {
+        int data;
+        struct node* next;
+    } node_t;
+
+    node_t* head = NULL;
+
+    for (int i = 0; i < count / 2; i++) {
+        node_t* new_node = bench_malloc(w, sizeof(node_t));
+        if (new_node == NULL) {
+            printf("Task 4 malloc failed at %d\n", i);
+            exit(1);
+        }
+        new_node->data = i;
+        new_node->next = head;
+        head = new_node;
+    }
+
+    node_t* curr = head;
+    node_t* prev = NULL;
+    for (int cnt = 0; curr != NULL; cnt++) {
+        if (cnt % 2 == 1) {
+            prev->next = curr->next;
+            bench_free(w, curr);
+            curr = prev->next;
+        } else {
+            prev = curr;
+            curr = curr->next;
+        }
+    }
+
+    while (head != NULL) {
+        node_t* temp = head;
+        head = head->next;
+        bench_free(w, temp);
+    }
+}
+
+// Task 5: dynamic array resizing with realloc. A block is only ever
+// resized by the thread that holds it; in the cross pattern only the
+// final free goes to the partner.
+static void task5(worker_t* w) {
+    int curr_size = 10;
+
+    int* array = bench_malloc(w, curr_size * sizeof(int));
+    if (array == NULL) {
+        printf("Task 5 initial malloc failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < curr_size; i++) {
+        array[i] = i;
+    }
+
+    for (int op = 0; op < 100; op++) {
+        int operation = rand_r(&w->seed) % 3;
+        int new_size = curr_size;
+
+        if (operation == 0 && curr_size > 5) {
+            new_size = curr_size / 2;
+        } else if (operation == 1 && curr_size < 80) {
+            new_size = curr_size * 2;
+        } else {
+            continue;
+        }
+
+        int* new_array = bench_realloc(w, array, new_size * sizeof(int));
+        if (new_array == NULL) {
+            printf("Task 5 realloc failed\n");
+            exit(1);
+        }
+        for (int i = curr_size; i < new_size; i++) {
+            new_array[i] = i;
+        }
+        array = new_array;
+        curr_size = new_size;
+    }
+
+    bench_free(w, array);
+}
+
+static void (*tasks[NUM_TASKS])(worker_t*) = {task1, task2, task3, task4, task5};
+
+static const char* task_names[NUM_TASKS] = {
+    "Task 1: malloc/free cycles",
+    "Task 2: bulk alloc/free",
+    "Task 3: random ops",
+    "Task 4: linked list",
+    "Task 5: dynamic arrays"
+};
+
+// Warm up, wait for every thread, then time num_runs runs of the task
+static void* run_worker(void* arg) {
+    worker_t* w = arg;
+
+    w->recording = 0;
+    for (int run = 0; run < warmup_runs; run++) {
+        tasks[w->task](w);
+    }
+    finish(w, 1);
+
+    pthread_barrier_wait(&start_barrier);
+
+    w->recording = 1;
+    w->start_ns = now_ns();
+    for (int run = 0; run < num_runs; run++) {
+        tasks[w->task](w);
+    }
+    finish(w, 2);
+    w->end_ns = now_ns();
+    w->recording = 0;
+
+    return NULL;
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile, in tenths of a percent, of sorted samples
+static long percentile(const long* samples, size_t n, int permille) {
+    if (n == 0) {
+        return 0;
+    }
+    return samples[(n - 1) * permille / 1000];
+}
+
+// Run one task on n threads at once and fill in result
+static void run_threads(const allocator_t* a, int task, int cross, int n,
+                        unsigned int seed, mt_result_t* result) {
+    worker_t* workers = (calloc)(n, sizeof(worker_t));
+    if (workers == NULL) {
+        printf("Out of memory for workers\n");
+        exit(1);
+    }
+
+    // threads are paired 0-1, 2-3, ...; one left over frees its own
+    for (int i = 0; i < n; i++) {
+        workers[i].alloc = a;
+        workers[i].task = task;
+        workers[i].cross = cross;
+        workers[i].seed = seed + i;
+        workers[i].partner = (i ^ 1) < n ? &workers[i ^ 1] : &workers[i];
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, n);
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            printf("Could not start thread %d\n", i);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    // wall time from the first thread starting to the last one finishing
+    long start = workers[0].start_ns;
+    long end = workers[0].end_ns;
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        if (workers[i].start_ns < start) {
+            start = workers[i].start_ns;
+        }
+        if (workers[i].end_ns > end) {
+            end = workers[i].end_ns;
+        }
+        total += workers[i].num_samples;
+    }
+
+    long* samples = (malloc)((total + 1) * sizeof(long));
+    if (samples == NULL) {
+        printf("Out of memory for samples\n");
+        exit(1);
+    }
+    size_t num_samples = 0;
+    for (int i = 0; i < n; i++) {
+        memcpy(samples + num_samples, workers[i].samples, workers[i].num_samples * sizeof(long));
+        num_samples += workers[i].num_samples;
+        (free)(workers[i].samples);
+    }
+    qsort(samples, num_samples, sizeof(long), compare_long);
+
+    result->ops_per_sec = end > start ? num_samples * 1e9 / (end - start) : 0;
+    result->p50 = percentile(samples, num_samples, 500);
+    result->p99 = percentile(samples, num_samples, 990);
+    result->p999 = percentile(samples, num_samples, 999);
+    result->max = num_samples > 0 ? samples[num_samples - 1] : 0;
+
+    (free)(samples);
+    (free)(workers);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t max threads] [-r runs] [-w warmup] [-n count] [-s size] [-S seed] [-f text|csv]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    unsigned int seed = time(NULL);
+    const char* format = "text";
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        char* value = argv[++i];
+        switch (argv[i - 1][1]) {
+            case 't': max_threads = atoi(value); break;
+            case 'r': num_runs = atoi(value); break;
+            case 'w': warmup_runs = atoi(value); break;
+            case 'n': count = atoi(value); break;
+            case 's': obj_size = strtoul(value, NULL, 10); break;
+            case 'S': seed = strtoul(value, NULL, 10); break;
+            case 'f': format = value; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    int csv = strcmp(format, "csv") == 0;
+    if ((!csv && strcmp(format, "text") != 0) || max_threads < 1 || max_threads > MAX_THREADS ||
+        num_runs < 1 || warmup_runs < 0 || count < 2 || count > MAX_COUNT || obj_size == 0) {
+        usage(argv[0]);
+    }
+
+    // 1, 2, 4, ... threads, and max_threads itself
+    int thread_counts[8];
+    int num_counts = 0;
+    for (int n = 1; n < max_threads; n *= 2) {
+        thread_counts[num_counts++] = n;
+    }
+    thread_counts[num_counts++] = max_threads;
+
+    static mt_result_t results[NUM_ALLOCATORS][2][NUM_TASKS][8];
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        for (int p = 0; p < 2; p++) {
+            for (int t = 0; t < NUM_TASKS; t++) {
+                for (int c = 0; c < num_counts; c++) {
+                    run_threads(&allocators[a], t, p, thread_counts[c], seed, &results[a][p][t][c]);
+                }
+            }
+        }
+    }
+
+    if (csv) {
+        printf("allocator,pattern,task,threads,ops_per_sec,scaling,p50_ns,p99_ns,p999_ns,max_ns\n");
+        for (int a = 0; a < NUM_ALLOCATORS; a++) {
+            for (int p = 0; p < 2; p++) {
+                for (int t = 0; t < NUM_TASKS; t++) {
+                    for (int c = 0; c < num_counts; c++) {
+                        const mt_result_t* r = &results[a][p][t][c];
+                        printf("%s,%s,%s,%d,%.0f,%.2f,%ld,%ld,%ld,%ld\n", allocators[a].name,
+                               pattern_names[p], task_names[t], thread_counts[c], r->ops_per_sec,
+                               r->ops_per_sec / results[a][p][t][0].ops_per_sec,
+                               r->p50, r->p99, r->p999, r->max);
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    printf("Multi-threaded stress test with %d runs (%d warm-up), %d objects, object size %zu, seed %u\n",
+           num_runs, warmup_runs, count, obj_size, seed);
+
+    // scaling is throughput over the same task's throughput on one thread
+    for (int a = 0; a < NUM_ALLOCATORS; a++) {
+        for (int p = 0; p < 2; p++) {
+            printf("\n=== %s, %s free ===\n", allocators[a].name, pattern_names[p]);
+            printf("%-26s %7s %12s %8s %8s %8s %9s %9s\n", "task", "threads", "ops/sec",
+                   "scaling", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+            for (int t = 0; t < NUM_TASKS; t++) {
+                for (int c = 0; c < num_counts; c++) {
+                    const mt_result_t* r = &results[a][p][t][c];
+                    printf("%-26s %7d %12.0f %7.2fx %8ld %8ld %8ld %9ld\n",
+                           c == 0 ? task_names[t] : "", thread_counts[c], r->ops_per_sec,
+                           r->ops_per_sec / results[a][p][t][0].ops_per_sec,
+                           r->p50, r->p99, r->p999, r->max);
+                }
+            }
+        }
+    }
+
+    // allocator 0 is mymalloc and 1 the libc baseline
+    int top = num_counts - 1;
+    printf("\nmymalloc against libc at %d threads:\n", thread_counts[top]);
+    printf("%-26s %8s %12s %12s %13s %13s\n", "task", "pattern", "ops/s ratio",
+           "p99 ratio", "mymalloc p99", "libc p99");
+    for (int t = 0; t < NUM_TASKS; t++) {
+        for (int p = 0; p < 2; p++) {
+            const mt_result_t* m = &results[0][p][t][top];
+            const mt_result_t* l = &results[1][p][t][top];
+            printf("%-26s %8s %11.2fx %11.2fx %13ld %13ld\n", p == 0 ? task_names[t] : "",
+                   pattern_names[p], l->ops_per_sec > 0 ? m->ops_per_sec / l->ops_per_sec : 0,
+                   l->p99 > 0 ? (double)m->p99 / l->p99 : 0, m->p99, l->p99);
+        }
+    }
+
+    printf("\nMemgrind-mt done!\n");
+    return 0;
+}
@@ -1,221 +1,2848 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#ifdef THREADSAFE
+#include <pthread.h>
+#endif
 #include "mymalloc.h"
+#include "mytrace.h"
+#include "myprofile.h"
+#include "mysnapshot.h"
 
-#define MEMLENGTH 4096
+#define MEMLENGTH (1 << 20)  // default arena size, override with MYMALLOC_ARENA_SIZE
 #define HEADER_SIZE 8
-#define MIN_CHUNK_SIZE 16
+#define FOOTER_SIZE 8
+#define MIN_CHUNK_SIZE 32  // header + two free list links + footer
 
-// Global heap 
-static union {
-    char bytes[MEMLENGTH];
-    double not_used;  
-} heap;
+// Payloads are 8-byte aligned. Build with -DPRELOAD, as libmymalloc.so
+// is, to align them to 16 like the C library does: an arena's first
+// chunk then starts ARENA_LEAD bytes into the mapping and every payload
+// size is 8 more than a multiple of 16, so each header sits just below
+// a 16-byte boundary.
+#ifdef PRELOAD
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT 8
+#endif
+#define ARENA_LEAD (ALIGNMENT - HEADER_SIZE)
+
+// Flag bits kept below the 8-byte aligned size
+#define ALLOC_BIT 1      // chunk is allocated
+#define PREV_FREE_BIT 2  // chunk before this one is free and has a footer
+#define BATCH_BIT 4      // free: freed by myfree_batch, not merged or listed yet
+#define HANDLE_BIT 4     // allocated: a handle block that compaction may move
+#define FLAG_MASK 7
+
+// Two-level segregated fit index. The first level splits sizes by power
+// of two, the second level splits each power of two into SL_COUNT ranges.
+// Sizes below SMALL_SIZE all live in first level 0, one list per 8 bytes.
+#define ALIGN_LOG2 3
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + ALIGN_LOG2)
+#define FL_MAX 48
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+#define SMALL_SIZE ((size_t)1 << FL_SHIFT)
+#define MAX_REQUEST ((size_t)1 << (FL_MAX - 1))
+
+// Placement policy used when none is set at run time, build with e.g.
+// -DPOLICY=MYMALLOC_BEST_FIT to change it
+#ifndef POLICY
+#define POLICY MYMALLOC_TLSF
+#endif
+
+// Build with -DBUDDY to keep chunks in a binary buddy system instead of
+// the TLSF index. Every chunk is then a power-of-two block, header
+// included, at an arena offset that is a multiple of its size, so the
+// block it splits from or merges with is found by flipping one bit of
+// its offset. Placement policies do not apply.
+#ifdef BUDDY
+#define USE_BUDDY 1
+#else
+#define USE_BUDDY 0
+#endif
+#define BUDDY_MIN_LOG2 5  // header + two free list links
+#define BUDDY_ORDERS 64
+
+// Requests up to SLAB_MAX bytes come from slabs: SLAB_PAGE-byte chunks
+// cut into objects of one size class (8, 16, 32 or 64 bytes, no 8 in
+// the PRELOAD build). The objects have no header, the slab keeps their
+// metadata at its start.
+#define SLAB_PAGE 512
+#define SLAB_MAX 64
+#define SLAB_CLASSES 4
+
+// Deferred coalescing, off unless MYMALLOC_QUICK_LISTS=1 is set or
+// mymalloc_set_quick_lists() turns it on. A freed chunk of up to
+// QUICK_MAX bytes then keeps its ALLOC_BIT, so no neighbour merges with
+// it, and waits on a list of chunks of exactly its size for the next
+// request of that size. Only its used map bit is cleared, so it already
+// counts as freed for error checks and stats. A list is merged into the
+// heap when it grows past QUICK_COUNT chunks, and all of them are when a
+// request finds no free chunk.
+#define QUICK_MAX 512
+#define QUICK_BINS (QUICK_MAX / 8 + 1)
+#define QUICK_COUNT 32
+
+// Page map from page number to arena. The root covers a 48-bit address
+// space with 4096-byte pages, leaves are mapped the first time an arena
+// lands in their range and are never freed.
+#define PM_ADDR_BITS 48
+#define PM_LEAF_BITS 18
+#define PM_ROOT_BITS (PM_ADDR_BITS - 12 - PM_LEAF_BITS)
+
+// mymalloc_snapshot writes its records through a buffer of this many on
+// the stack, and remembers which of the trace's file numbers (at most
+// SNAPSHOT_SITES) it has already named
+#define SNAPSHOT_BUFFER 128
+#define SNAPSHOT_SITES 1024
+
+// Default payload of a region block, small enough that one fits in a
+// default arena
+#define REGION_BLOCK 2048
+
+// An arena is one anonymous mapping. The chunks start at the beginning of
+// the mapping and end with a zero-size allocated sentinel header, so
+// merging never runs past the end. The descriptor sits after the sentinel,
+// followed by one bit per SLAB_PAGE of the arena marking the slab pages,
+// then one bit per 8 bytes marking where allocated chunks start.
+typedef struct arena {
+    struct arena* next;
+    struct arena* prev;
+    char* bytes;        // first chunk, ARENA_LEAD bytes into the mapping
+    size_t length;      // bytes available for chunks
+    size_t map_length;  // whole mapping including sentinel and descriptor
+    char* fresh;        // bytes from here on have never been handed out
+    uint64_t* used_map; // allocated chunk headers, after slab_map
+    uint64_t slab_map[];
+} arena_t;
+
+// Slab page header, at the start of the slab chunk's payload
+typedef struct slab {
+    struct slab* next;  // slabs of the same class with free objects
+    struct slab* prev;
+    void* free_list;    // free objects, linked through their first word
+    uint64_t used_map;  // bit per object that is handed out
+    uint32_t obj_size;
+    uint16_t capacity;
+    uint16_t used;
+} slab_t;
+
+// Objects start this far into a slab, on an ALIGNMENT boundary
+#define SLAB_HEADER ((sizeof(slab_t) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+// Global heap, the first arena is kept for the life of the program
+static arena_t* arenas = NULL;
+static size_t arena_size = MEMLENGTH;
+static size_t page_size;
+static int page_shift;
+
+static struct arena** pagemap[1 << PM_ROOT_BITS];
+
+static slab_t* partial_slabs[SLAB_CLASSES];
+
+typedef struct {
+    void* head;  // payloads, linked through their first word
+    int count;
+} quick_bin_t;
+
+static int quick_lists = 0;
+static quick_bin_t quick_bins[QUICK_BINS];
 
 static int initialized = 0;
 
-// Chunk header
+// With -DTHREADSAFE one lock guards the arenas and free lists, and each
+// thread keeps a cache of small freed blocks that it can reuse without
+// taking the lock
+#ifdef THREADSAFE
+#define TCACHE_MAX_SIZE 128  // largest payload kept in a thread cache
+#define TCACHE_BINS (TCACHE_MAX_SIZE / 8 + 1)
+#define TCACHE_COUNT 16      // blocks per bin before it is flushed
+#define TCACHE_BATCH 8       // blocks moved per refill or flush
+
 typedef struct {
+    void* head;  // cached payloads, linked through their first word
+    int count;
+} tcache_bin_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static __thread tcache_bin_t tcache[TCACHE_BINS];
+static __thread int tcache_registered;
+
+#define LOCK() pthread_mutex_lock(&heap_lock)
+#define UNLOCK() pthread_mutex_unlock(&heap_lock)
+#define COUNT(X) __atomic_fetch_add(&(X), 1, __ATOMIC_RELAXED)
+#define COUNT_N(X, N) __atomic_fetch_add(&(X), (N), __ATOMIC_RELAXED)
+#else
+#define LOCK()
+#define UNLOCK()
+#define COUNT(X) ((X)++)
+#define COUNT_N(X, N) ((X) += (N))
+#endif
+
+// Chunk header, the links are only valid while the chunk is free and
+// live in the first bytes of the payload. A free chunk also repeats its
+// size in the last 8 bytes of the payload so the next chunk can find it.
+typedef struct chunk {
     size_t size_and_flag;  
+    struct chunk* next_free;
+    struct chunk* prev_free;
 } chunk_t;
 
+// Free list heads plus bitmaps of which lists are non-empty
+static uint64_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+static chunk_t* free_lists[FL_COUNT][SL_COUNT];
+
+// Buddy free lists, one per block size, used instead of the above
+// with -DBUDDY
+static chunk_t* buddy_lists[BUDDY_ORDERS];
+static uint64_t buddy_bitmap;
+
+static int policy = POLICY;
+static chunk_t* rover = NULL;  // where the next next-fit search starts
+static size_t heap_bytes = 0;
+static size_t peak_heap_bytes = 0;
+
+// Call counters for mymalloc_stats. The search and merge counters are
+// only touched under the lock.
+static size_t malloc_calls = 0;
+static size_t realloc_calls = 0;
+static size_t free_calls = 0;
+static size_t failed_calls = 0;
+static size_t merges = 0;
+static size_t searches = 0;
+static size_t chunks_scanned = 0;
+
+// A region bump-allocates out of blocks taken from the heap. region_reset
+// only moves back to the first block, the blocks are kept and refilled.
+typedef struct region_block {
+    struct region_block* next;
+    size_t size;  // bytes after this header
+} region_block_t;
+
+struct region {
+    struct region* next;  // live regions, for the leak check
+    struct region* prev;
+    region_block_t head;  // empty, its next is the first real block
+    region_block_t* current;
+    char* top;            // next free byte of current
+    char* end;
+    size_t block_size;
+    size_t objects;       // since the last reset
+    size_t bytes;
+    char* file;           // where it was created
+    int line;
+};
+
+static region_t* regions = NULL;
+
+typedef struct {
+    int fd;
+    int failed;
+    int buffered;
+    uint64_t named[SNAPSHOT_SITES / 64];  // trace file numbers written out
+    snapshot_record_t records[SNAPSHOT_BUFFER];
+} snapshot_writer_t;
+
+// A handle block is an ordinary chunk that starts with a pointer back to
+// its handle, so compaction can move it and tell the handle where it
+// went. The caller's bytes follow that pointer.
+struct handle {
+    chunk_t* chunk;
+    size_t locks;  // the block does not move while this is above 0
+};
+
+// MYMALLOC_STATS in the environment prints the stats at exit, on a
+// failed allocation, and on the first call after a SIGUSR1
+static int stats_enabled = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+// Leaks are reported at exit, except in the PRELOAD build where only
+// MYMALLOC_LEAKS in the environment turns the report on
+static int leak_report = 1;
+
 // Forward declarations
 static void init_heap(void);
+static arena_t* new_arena(size_t min_payload);
+static void release_arena(arena_t* arena);
+static arena_t* find_arena(void* ptr);
+static void pagemap_set(char* start, size_t length, arena_t* arena);
+static void mapping(size_t size, int* fl, int* sl);
+static void insert_free(chunk_t* chunk);
+static void remove_free(chunk_t* chunk);
 static chunk_t* find_free(size_t size);
+static chunk_t* find_tlsf(size_t size);
+static chunk_t* find_best_fit(size_t size);
+static chunk_t* scan_chunks(char* from, char* to, size_t size);
+static chunk_t* find_first_fit(size_t size);
+static chunk_t* find_next_fit(size_t size);
 static void split_chunk(chunk_t* chunk, size_t size);
-static void coalesce(void);
+static chunk_t* merge_neighbours(chunk_t* chunk);
+static chunk_t* take_chunk(size_t size);
+static void* use_chunk(chunk_t* chunk, size_t size);
+static void shrink_chunk(chunk_t* chunk, size_t size, arena_t* arena);
+static int grow_chunk(chunk_t* chunk, size_t size, arena_t* arena);
+static void* heap_alloc(size_t size);
+static void* heap_alloc_aligned(size_t size, size_t align, size_t offset);
+static int heap_alloc_batch(size_t n, size_t size, void** ptrs);
+static void heap_free(chunk_t* chunk, arena_t* arena);
+static void heap_merge_batch(chunk_t* chunk);
+static size_t buddy_block(size_t size);
+static void buddy_insert(chunk_t* chunk);
+static void buddy_remove(chunk_t* chunk);
+static void buddy_add_arena(arena_t* arena);
+static int buddy_arena_empty(arena_t* arena);
+static chunk_t* buddy_take(size_t size);
+static void buddy_split(chunk_t* chunk, size_t block);
+static int buddy_grow(chunk_t* chunk, size_t size, arena_t* arena);
+static void* buddy_alloc_aligned(size_t size, size_t align, size_t offset);
+static int buddy_inner(chunk_t* chunk, arena_t* arena);
+static chunk_t* buddy_merge(chunk_t* chunk, arena_t* arena);
+static void set_chunk_used(arena_t* arena, chunk_t* chunk, int used);
+static int chunk_used(arena_t* arena, chunk_t* chunk);
+static slab_t* find_slab(arena_t* arena, void* ptr);
+static void* slab_alloc(int cls);
+static void slab_free(slab_t* slab, arena_t* arena, void* ptr);
+static void* quick_get(size_t size);
+static int quick_put(chunk_t* chunk, arena_t* arena);
+static void quick_flush(quick_bin_t* bin);
+static int quick_flush_all(void);
+static void* block_alloc(size_t size);
+static void block_free(void* ptr, arena_t* arena, slab_t* slab);
 static int valid_ptr(void* ptr);
+static size_t checked_block(void* ptr, arena_t** arena, slab_t** slab);
+static size_t round_payload(size_t size);
+static size_t request_size(size_t size);
 static void check_leaks(void);
+static void heap_usage(mymalloc_stats_t* stats);
+static void request_stats(int sig);
+static void print_stats_at_exit(void);
+static int watching(void);
+static void region_leaks(mymalloc_stats_t* stats);
+static size_t compact_arena(arena_t* arena);
+static int write_all(int fd, const void* data, size_t length);
+static void snapshot_chunk(snapshot_writer_t* w, arena_t* arena, chunk_t* chunk, int traced);
+static snapshot_record_t* snapshot_next(snapshot_writer_t* w);
+static void snapshot_flush(snapshot_writer_t* w);
+static void* region_next_block(region_t* region, size_t size);
+static void* alloc_request(size_t size, char* file, int line);
+static void free_request(void* ptr, char* file, int line);
+static void* realloc_request(void* ptr, size_t size, char* file, int line);
+static void* calloc_request(size_t count, size_t size, char* file, int line);
+static void* aligned_request(size_t alignment, size_t size, char* file, int line);
+static size_t alloc_batch_request(size_t n, size_t size, void** ptrs, char* file, int line);
+static void free_batch_request(void** ptrs, size_t n, char* file, int line);
+#ifdef THREADSAFE
+static void* tcache_get(size_t size);
+static void tcache_flush(tcache_bin_t* bin, int n);
+static int tcache_mark(void* ptr, arena_t* arena, slab_t* slab, int cached);
+static void tcache_register(void);
+static int tcache_put(void* ptr, size_t size, arena_t* arena, slab_t* slab);
+static void tcache_release(void* cache);
+static void fork_prepare(void);
+static void fork_release(void);
+#endif
+
+// Index of the highest set bit
+static int fls_size(size_t x) {
+    return (int)(sizeof(unsigned long long) * 8) - 1 - __builtin_clzll(x);
+}
+
+static size_t chunk_size(chunk_t* chunk) {
+    return chunk->size_and_flag & ~(size_t)FLAG_MASK;
+}
+
+// Next chunk in address order, the arena sentinel after the last chunk
+static chunk_t* next_chunk(chunk_t* chunk) {
+    return (chunk_t*)((char*)chunk + HEADER_SIZE + chunk_size(chunk));
+}
+
+// Set or clear the prev-free bit of a neighbour. The neighbour may be a
+// block another thread is checking in myfree, so update it atomically.
+static void set_prev_free(chunk_t* chunk, int is_free) {
+    if (is_free) {
+        __atomic_fetch_or(&chunk->size_and_flag, PREV_FREE_BIT, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&chunk->size_and_flag, ~(size_t)PREV_FREE_BIT, __ATOMIC_RELAXED);
+    }
+}
+
+// Mark a chunk free: write its footer and tell the next chunk about it
+static void set_free(chunk_t* chunk, size_t size) {
+    chunk->size_and_flag = size | (chunk->size_and_flag & PREV_FREE_BIT);
+    *(size_t*)((char*)chunk + HEADER_SIZE + size - FOOTER_SIZE) = size;
+    set_prev_free(next_chunk(chunk), 1);
+}
 
 // Initialize heap
 static void init_heap(void) {
-    chunk_t* first = (chunk_t*)heap.bytes;
-    size_t avail = MEMLENGTH - HEADER_SIZE;
-    first->size_and_flag = avail & ~1; // clear LSB
-    initialized = 1;
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    page_shift = __builtin_ctzll(page_size);
+
+    char* env = getenv("MYMALLOC_ARENA_SIZE");
+    if (env) {
+        size_t requested = strtoul(env, NULL, 0);
+        if (requested > 0) {
+            arena_size = requested;
+        }
+    }
+    if (arena_size < page_size) {
+        arena_size = page_size;
+    }
+    
+    env = getenv("MYMALLOC_QUICK_LISTS");
+    if (env && *env && strcmp(env, "0") != 0 && !USE_BUDDY) {
+        quick_lists = 1;
+    }
+    
+    env = getenv("MYMALLOC_POLICY");
+    if (env) {
+        if (strcmp(env, "tlsf") == 0) {
+            policy = MYMALLOC_TLSF;
+        } else if (strcmp(env, "first") == 0) {
+            policy = MYMALLOC_FIRST_FIT;
+        } else if (strcmp(env, "next") == 0) {
+            policy = MYMALLOC_NEXT_FIT;
+        } else if (strcmp(env, "best") == 0) {
+            policy = MYMALLOC_BEST_FIT;
+        }
+    }
+    arena_size = (arena_size + page_size - 1) & ~(page_size - 1);
+    
+    // leave SIGUSR1 alone if the program already handles it
+    env = getenv("MYMALLOC_STATS");
+    if (env && *env && strcmp(env, "0") != 0) {
+        stats_enabled = 1;
+        struct sigaction old;
+        if (sigaction(SIGUSR1, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+            signal(SIGUSR1, request_stats);
+        }
+        atexit(print_stats_at_exit);
+    }
+
+#ifdef PRELOAD
+    // a preloaded program never asked for a leak report, and most leave
+    // blocks live at exit on purpose
+    env = getenv("MYMALLOC_LEAKS");
+    leak_report = env && *env && strcmp(env, "0") != 0;
+#endif
+
+#ifdef THREADSAFE
+    pthread_key_create(&tcache_key, tcache_release);
+    pthread_atfork(fork_prepare, fork_release, fork_release);
+#endif
+
+    new_arena(0);
     atexit(check_leaks);
+    __atomic_store_n(&initialized, 1, __ATOMIC_RELEASE);
 }
 
-// Find free chunk big enough
-static chunk_t* find_free(size_t size) {
-    char* curr = heap.bytes;
-    char* end = heap.bytes + MEMLENGTH;
+// Map a new arena big enough for a min_payload chunk and put its single
+// free chunk on the free lists
+static arena_t* new_arena(size_t min_payload) {
+    if (USE_BUDDY) {
+        min_payload = buddy_block(min_payload);
+    }
     
-    while (curr < end) {
-        chunk_t* chunk = (chunk_t*)curr;
-        size_t chunk_size = chunk->size_and_flag & ~1;
+    size_t map_length = arena_size;
+    size_t needed = min_payload + 2 * HEADER_SIZE + sizeof(arena_t);
+    needed += needed / SLAB_PAGE / 8 + sizeof(uint64_t);
+    needed += needed / 64 + sizeof(uint64_t);
+    if (needed > map_length) {
+        map_length = (needed + page_size - 1) & ~(page_size - 1);
+    }
+    
+    // the maps cover the whole mapping, so the guess above can come up
+    // a little short once they are rounded to whole words
+    size_t slab_words, length;
+    for (;;) {
+        slab_words = (map_length / SLAB_PAGE + 63) / 64;
+        size_t used_words = (map_length / 8 + 63) / 64;
+        size_t overhead = ARENA_LEAD + HEADER_SIZE + sizeof(arena_t) +
+                          (slab_words + used_words) * sizeof(uint64_t);
         
-        if (chunk_size == 0 || curr + HEADER_SIZE + chunk_size > end) {
+        length = (map_length - overhead) & ~(size_t)(ALIGNMENT - 1);
+        if (USE_BUDDY) {
+            length &= ~(((size_t)1 << BUDDY_MIN_LOG2) - 1);
+        }
+        if (length >= min_payload + HEADER_SIZE) {
             break;
         }
-        
-        // check if free and big enough
-        if (!(chunk->size_and_flag & 1) && chunk_size >= size) {
-            return chunk;
+        map_length += page_size;
+    }
+
+    char* base = mmap(NULL, map_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    char* bytes = base + ARENA_LEAD;
+    arena_t* arena = (arena_t*)(bytes + length + HEADER_SIZE);
+    arena->bytes = bytes;
+    arena->length = length;
+    arena->map_length = map_length;
+    arena->fresh = bytes + HEADER_SIZE + 2 * sizeof(chunk_t*);
+    arena->used_map = arena->slab_map + slab_words;
+
+    // keep the first arena at the head, it is never released
+    arena->prev = NULL;
+    arena->next = NULL;
+    if (arenas) {
+        arena->prev = arenas;
+        arena->next = arenas->next;
+        if (arenas->next) {
+            arenas->next->prev = arena;
         }
-        
-        curr += HEADER_SIZE + chunk_size;
+        arenas->next = arena;
+    } else {
+        arenas = arena;
+    }
+
+    chunk_t* sentinel = (chunk_t*)(bytes + length);
+    sentinel->size_and_flag = ALLOC_BIT;
+
+    if (USE_BUDDY) {
+        buddy_add_arena(arena);
+    } else {
+        chunk_t* first = (chunk_t*)bytes;
+        first->size_and_flag = 0;
+        set_free(first, length - HEADER_SIZE);
+        insert_free(first);
     }
+
+    pagemap_set(base, map_length, arena);
     
+    heap_bytes += map_length;
+    if (heap_bytes > peak_heap_bytes) {
+        peak_heap_bytes = heap_bytes;
+    }
+    return arena;
+}
+
+// Give an arena that holds only free chunks back to the kernel
+static void release_arena(arena_t* arena) {
+    if (USE_BUDDY) {
+        for (char* curr = arena->bytes; curr < arena->bytes + arena->length; ) {
+            chunk_t* chunk = (chunk_t*)curr;
+            buddy_remove(chunk);
+            curr += HEADER_SIZE + chunk_size(chunk);
+        }
+    } else {
+        remove_free((chunk_t*)arena->bytes);
+    }
+    if (rover && find_arena(rover) == arena) {
+        rover = NULL;
+    }
+    heap_bytes -= arena->map_length;
+
+    arena->prev->next = arena->next;
+    if (arena->next) {
+        arena->next->prev = arena->prev;
+    }
+
+    pagemap_set(arena->bytes - ARENA_LEAD, arena->map_length, NULL);
+    munmap(arena->bytes - ARENA_LEAD, arena->map_length);
+}
+
+// Point every page of a mapping at its arena, called with the lock held
+static void pagemap_set(char* start, size_t length, arena_t* arena) {
+    uintptr_t first = (uintptr_t)start >> page_shift;
+    uintptr_t last = ((uintptr_t)start + length - 1) >> page_shift;
+
+    for (uintptr_t page = first; page <= last; page++) {
+        uintptr_t root = page >> PM_LEAF_BITS;
+        arena_t** leaf = pagemap[root];
+
+        if (!leaf) {
+            leaf = mmap(NULL, sizeof(arena_t*) << PM_LEAF_BITS, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (leaf == MAP_FAILED) {
+                return;
+            }
+            __atomic_store_n(&pagemap[root], leaf, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&leaf[page & ((1 << PM_LEAF_BITS) - 1)], arena, __ATOMIC_RELEASE);
+    }
+}
+
+// Arena holding ptr, or NULL if it is outside every arena. This only
+// reads the page map, so it is safe without the lock.
+static arena_t* find_arena(void* ptr) {
+    char* p = (char*)ptr;
+
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    uintptr_t page = (uintptr_t)p >> page_shift;
+    if (page >> (PM_ROOT_BITS + PM_LEAF_BITS)) {
+        return NULL;
+    }
+
+    arena_t** leaf = __atomic_load_n(&pagemap[page >> PM_LEAF_BITS], __ATOMIC_ACQUIRE);
+    if (!leaf) {
+        return NULL;
+    }
+
+    arena_t* a = __atomic_load_n(&leaf[page & ((1 << PM_LEAF_BITS) - 1)], __ATOMIC_ACQUIRE);
+    if (a && p >= a->bytes && p < a->bytes + a->length) {
+        return a;
+    }
+
     return NULL;
 }
 
-// Split chunk if too big
-static void split_chunk(chunk_t* chunk, size_t size) {
-    size_t chunk_size = chunk->size_and_flag & ~1;
+// Map a chunk size to its first and second level list
+static void mapping(size_t size, int* fl, int* sl) {
+    if (size < SMALL_SIZE) {
+        *fl = 0;
+        *sl = (int)(size >> ALIGN_LOG2);
+    } else {
+        int bit = fls_size(size);
+        *sl = (int)((size >> (bit - SL_LOG2)) ^ SL_COUNT);
+        *fl = bit - FL_SHIFT + 1;
+    }
+}
+
+// Put a free chunk at the head of its size class list
+static void insert_free(chunk_t* chunk) {
+    int fl, sl;
+    mapping(chunk_size(chunk), &fl, &sl);
+
+    chunk->prev_free = NULL;
+    chunk->next_free = free_lists[fl][sl];
+    if (chunk->next_free) {
+        chunk->next_free->prev_free = chunk;
+    }
+    free_lists[fl][sl] = chunk;
+
+    fl_bitmap |= 1ULL << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+// Unlink a free chunk from its size class list
+static void remove_free(chunk_t* chunk) {
+    int fl, sl;
+    mapping(chunk_size(chunk), &fl, &sl);
+
+    if (chunk->prev_free) {
+        chunk->prev_free->next_free = chunk->next_free;
+    } else {
+        free_lists[fl][sl] = chunk->next_free;
+    }
+    if (chunk->next_free) {
+        chunk->next_free->prev_free = chunk->prev_free;
+    }
+
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~(1ULL << fl);
+        }
+    }
+}
+
+// Find free chunk big enough, with the current placement policy
+static chunk_t* find_free(size_t size) {
+    searches++;
+    switch (policy) {
+    case MYMALLOC_FIRST_FIT:
+        return find_first_fit(size);
+    case MYMALLOC_NEXT_FIT:
+        return find_next_fit(size);
+    case MYMALLOC_BEST_FIT:
+        return find_best_fit(size);
+    default:
+        return find_tlsf(size);
+    }
+}
+
+// Segregated fit: pick any chunk from the first non-empty list whose
+// chunks are all big enough
+static chunk_t* find_tlsf(size_t size) {
+    int fl, sl;
+
+    // round up to the next list boundary so any chunk found there fits
+    size_t search = size;
+    if (search >= SMALL_SIZE) {
+        search += ((size_t)1 << (fls_size(search) - SL_LOG2)) - 1;
+    }
+    mapping(search, &fl, &sl);
+
+    if (fl < FL_COUNT) {
+        uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+        if (!sl_map) {
+            uint64_t fl_map = (fl + 1 < FL_COUNT) ? fl_bitmap & (~0ULL << (fl + 1)) : 0;
+            if (fl_map) {
+                fl = __builtin_ctzll(fl_map);
+                sl_map = sl_bitmap[fl];
+            }
+        }
+        if (sl_map) {
+            chunks_scanned++;
+            return free_lists[fl][__builtin_ctz(sl_map)];
+        }
+    }
+
+    // rounding skips the request's own list, which may still hold a fit
+    mapping(size, &fl, &sl);
+    for (chunk_t* c = free_lists[fl][sl]; c; c = c->next_free) {
+        chunks_scanned++;
+        if (chunk_size(c) >= size) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+// Smallest free chunk that fits. Every chunk in a later list is bigger
+// than any chunk in an earlier one, so only two lists need scanning: the
+// request's own list, then the next non-empty one.
+static chunk_t* find_best_fit(size_t size) {
+    int fl, sl;
+    mapping(size, &fl, &sl);
     
-    if (chunk_size >= size + MIN_CHUNK_SIZE) {
-        char* new_addr = (char*)chunk + HEADER_SIZE + size;
-        chunk_t* new_chunk = (chunk_t*)new_addr;
+    for (int pass = 0; pass < 2; pass++) {
+        chunk_t* best = NULL;
         
-        size_t remaining = chunk_size - size - HEADER_SIZE;
-        new_chunk->size_and_flag = remaining & ~1; // free
+        for (chunk_t* c = free_lists[fl][sl]; c; c = c->next_free) {
+            chunks_scanned++;
+            if (chunk_size(c) >= size && (!best || chunk_size(c) < chunk_size(best))) {
+                best = c;
+            }
+        }
+        if (best) {
+            return best;
+        }
         
-        chunk->size_and_flag = (size & ~1) | (chunk->size_and_flag & 1);
+        uint32_t sl_map = sl + 1 < SL_COUNT ? sl_bitmap[fl] & (~0U << (sl + 1)) : 0;
+        if (!sl_map) {
+            uint64_t fl_map = (fl + 1 < FL_COUNT) ? fl_bitmap & (~0ULL << (fl + 1)) : 0;
+            if (!fl_map) {
+                return NULL;
+            }
+            fl = __builtin_ctzll(fl_map);
+            sl_map = sl_bitmap[fl];
+        }
+        sl = __builtin_ctz(sl_map);
     }
+    
+    return NULL;
 }
 
-// Merge adjacent free chunks
-static void coalesce(void) {
-    char* curr = heap.bytes;
-    char* end = heap.bytes + MEMLENGTH;
+// First free chunk in [from, to) that fits, in address order
+static chunk_t* scan_chunks(char* from, char* to, size_t size) {
+    char* curr = from;
     
-    while (curr < end) {
+    while (curr < to) {
         chunk_t* chunk = (chunk_t*)curr;
-        size_t chunk_size = chunk->size_and_flag & ~1;
-        
-        if (chunk_size == 0) break;
+        chunks_scanned++;
         
-        // if current chunk is free
-        if (!(chunk->size_and_flag & 1)) {
-            char* next_addr = curr + HEADER_SIZE + chunk_size;
-            
-            if (next_addr < end) {
-                chunk_t* next = (chunk_t*)next_addr;
-                size_t next_size = next->size_and_flag & ~1;
-                
-                // if next chunk is also free, merge them
-                if (next_size > 0 && !(next->size_and_flag & 1)) {
-                    size_t merged = chunk_size + HEADER_SIZE + next_size;
-                    chunk->size_and_flag = merged & ~1;
-                    continue; // don't advance, check for more merges
-                }
-            }
+        if (!(chunk->size_and_flag & ALLOC_BIT) && chunk_size(chunk) >= size) {
+            return chunk;
         }
         
-        curr += HEADER_SIZE + chunk_size;
+        curr += HEADER_SIZE + chunk_size(chunk);
     }
+    
+    return NULL;
 }
 
-// Check if pointer is valid
-static int valid_ptr(void* ptr) {
-    char* p = (char*)ptr;
+// First fit: walk the arenas from the start of the heap
+static chunk_t* find_first_fit(size_t size) {
+    for (arena_t* a = arenas; a; a = a->next) {
+        chunk_t* chunk = scan_chunks(a->bytes, a->bytes + a->length, size);
+        if (chunk) {
+            return chunk;
+        }
+    }
     
-    if (p < heap.bytes || p >= heap.bytes + MEMLENGTH) {
-        return 0;
+    return NULL;
+}
+
+// Next fit: walk from where the last search stopped to the end of the
+// heap, then wrap around to the rover
+static chunk_t* find_next_fit(size_t size) {
+    if (!rover) {
+        rover = find_first_fit(size);
+        return rover;
     }
     
-    // check alignment
-    if ((uintptr_t)p % 8 != 0) {
-        return 0;
+    arena_t* start = find_arena(rover);
+    chunk_t* chunk = scan_chunks((char*)rover, start->bytes + start->length, size);
+    
+    for (arena_t* a = start->next; !chunk && a; a = a->next) {
+        chunk = scan_chunks(a->bytes, a->bytes + a->length, size);
+    }
+    for (arena_t* a = arenas; !chunk && a != start; a = a->next) {
+        chunk = scan_chunks(a->bytes, a->bytes + a->length, size);
+    }
+    if (!chunk) {
+        chunk = scan_chunks(start->bytes, (char*)rover, size);
     }
     
-    return 1;
+    if (chunk) {
+        rover = chunk;
+    }
+    return chunk;
 }
 
-// Check for leaks at exit
-static void check_leaks(void) {
-    int count = 0;
-    size_t bytes = 0;
-    
-    char* curr = heap.bytes;
-    char* end = heap.bytes + MEMLENGTH;
+// Split chunk if too big, the remainder goes back on a free list
+static void split_chunk(chunk_t* chunk, size_t size) {
+    size_t total = chunk_size(chunk);
     
-    while (curr < end) {
-        chunk_t* chunk = (chunk_t*)curr;
-        size_t chunk_size = chunk->size_and_flag & ~1;
-        
-        if (chunk_size == 0) break;
+    if (total >= size + MIN_CHUNK_SIZE) {
+        char* new_addr = (char*)chunk + HEADER_SIZE + size;
+        chunk_t* new_chunk = (chunk_t*)new_addr;
         
-        if (chunk->size_and_flag & 1) { // allocated
-            count++;
-            bytes += chunk_size;
-        }
+        size_t remaining = total - size - HEADER_SIZE;
+        new_chunk->size_and_flag = 0;
+        set_free(new_chunk, remaining);
+        insert_free(new_chunk);
         
-        curr += HEADER_SIZE + chunk_size;
-    }
-    
-    if (count > 0) {
-        fprintf(stderr, "mymalloc: %zu bytes leaked in %d objects.\n", 
-                bytes, count);
+        chunk->size_and_flag = size | (chunk->size_and_flag & FLAG_MASK);
     }
 }
 
-void* mymalloc(size_t size, char* file, int line) {
-    if (!initialized) {
-        init_heap();
+// Merge a newly freed chunk with its free neighbours. The next chunk is
+// found from our size and the previous one from its footer, so this
+// never walks the heap.
+static chunk_t* merge_neighbours(chunk_t* chunk) {
+    size_t size = chunk_size(chunk);
+
+    // a batch chunk is not on a list yet, myfree_batch merges it later
+    chunk_t* next = next_chunk(chunk);
+    if (!(next->size_and_flag & (ALLOC_BIT | BATCH_BIT))) {
+        remove_free(next);
+        size += HEADER_SIZE + chunk_size(next);
+        merges++;
+    }
+
+    if (chunk->size_and_flag & PREV_FREE_BIT) {
+        size_t prev_size = *(size_t*)((char*)chunk - FOOTER_SIZE);
+        chunk_t* prev = (chunk_t*)((char*)chunk - prev_size - HEADER_SIZE);
+        remove_free(prev);
+        size += HEADER_SIZE + prev_size;
+        chunk = prev;
+        merges++;
     }
+
+    set_free(chunk, size);
     
-    if (size == 0) {
-        return NULL;
+    // the rover may point at a header that was just merged away
+    if (rover > chunk && (char*)rover < (char*)chunk + HEADER_SIZE + size) {
+        rover = chunk;
+    }
+    return chunk;
+}
+
+// Take a free chunk with at least size payload bytes off the free lists,
+// mapping a new arena if nothing fits
+static chunk_t* take_chunk(size_t size) {
+    if (USE_BUDDY) {
+        return buddy_take(size);
     }
     
-    // round up to multiple of 8
-    size_t aligned = (size + 7) & ~7;
+    // free chunks are always coalesced, except those on the quick lists,
+    // so on a miss we merge those and otherwise need a new arena
+    chunk_t* chunk = find_free(size);
     
-    chunk_t* chunk = find_free(aligned);
+    if (!chunk && quick_flush_all()) {
+        chunk = find_free(size);
+    }
     
     if (!chunk) {
-        coalesce(); // try merging free chunks
-        chunk = find_free(aligned);
-        
-        if (!chunk) {
-            fprintf(stderr, "malloc: Unable to allocate %zu bytes (%s:%d)\n", 
-                    size, file, line);
+        arena_t* arena = new_arena(size);
+        if (!arena) {
             return NULL;
         }
+        chunk = (chunk_t*)arena->bytes;
+    }
+    
+    remove_free(chunk);
+    return chunk;
+}
+
+// Trim a taken chunk down to size and mark it allocated
+static void* use_chunk(chunk_t* chunk, size_t size) {
+    if (!USE_BUDDY) {
+        split_chunk(chunk, size);
     }
     
-    split_chunk(chunk, aligned);
+    chunk->size_and_flag |= ALLOC_BIT;
+    chunk_t* next = next_chunk(chunk);
+    set_prev_free(next, 0);
+    
+    arena_t* arena = find_arena(chunk);
+    set_chunk_used(arena, chunk, 1);
     
-    chunk->size_and_flag |= 1; // mark allocated
+    // the caller will write the payload, and a split has written the
+    // header and links of the chunk after it
+    char* used = (char*)next + HEADER_SIZE + 2 * sizeof(chunk_t*);
+    if (used > arena->fresh) {
+        arena->fresh = used;
+    }
     
     return (char*)chunk + HEADER_SIZE;
 }
 
-void myfree(void* ptr, char* file, int line) {
-    if (ptr == NULL) {
+// Give the tail of an allocated chunk back to the free lists when it is
+// big enough to stand on its own, merging it with a free next chunk
+static void shrink_chunk(chunk_t* chunk, size_t size, arena_t* arena) {
+    if (USE_BUDDY) {
+        // an aligned block keeps all of the block it sits in
+        if (!buddy_inner(chunk, arena)) {
+            buddy_split(chunk, buddy_block(size));
+        }
         return;
     }
     
-    if (!valid_ptr(ptr)) {
-        fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
-        exit(2);
+    size_t total = chunk_size(chunk);
+    
+    if (total >= size + MIN_CHUNK_SIZE) {
+        chunk_t* tail = (chunk_t*)((char*)chunk + HEADER_SIZE + size);
+        tail->size_and_flag = (total - size - HEADER_SIZE) | ALLOC_BIT;
+        chunk->size_and_flag = size | (chunk->size_and_flag & FLAG_MASK);
+        heap_free(tail, arena);
+    }
+}
+
+// Grow an allocated chunk into a free next chunk. Returns 0 when the
+// next chunk is in use or too small.
+static int grow_chunk(chunk_t* chunk, size_t size, arena_t* arena) {
+    if (USE_BUDDY) {
+        return !buddy_inner(chunk, arena) && buddy_grow(chunk, size, arena);
     }
     
-    chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+    chunk_t* next = next_chunk(chunk);
     
-    if (!valid_ptr(chunk)) {
-        fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
-        exit(2);
+    if (next->size_and_flag & ALLOC_BIT) {
+        return 0;
     }
     
-    // check if already free
-    if (!(chunk->size_and_flag & 1)) {
-        fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
-        exit(2);
+    size_t total = chunk_size(chunk) + HEADER_SIZE + chunk_size(next);
+    if (total < size) {
+        return 0;
     }
     
-    // check size is reasonable
-    size_t chunk_size = chunk->size_and_flag & ~1;
-    if (chunk_size == 0 || (char*)chunk + HEADER_SIZE + chunk_size > heap.bytes + MEMLENGTH) {
-        fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
-        exit(2);
+    remove_free(next);
+    if (rover == next) {
+        rover = chunk;
+    }
+    chunk->size_and_flag = total | (chunk->size_and_flag & FLAG_MASK);
+    set_prev_free(next_chunk(chunk), 0);
+    shrink_chunk(chunk, size, arena);
+    
+    char* used = (char*)next_chunk(chunk) + HEADER_SIZE + 2 * sizeof(chunk_t*);
+    if (used > arena->fresh) {
+        arena->fresh = used;
+    }
+    
+    return 1;
+}
+
+// Carve a chunk with at least size payload bytes. Called with the lock
+// held, returns the payload.
+static void* heap_alloc(size_t size) {
+    chunk_t* chunk = take_chunk(size);
+    return chunk ? use_chunk(chunk, size) : NULL;
+}
+
+// Like heap_alloc, but the payload address minus offset is a multiple of
+// align. The slack in front of the aligned spot goes back on the free
+// lists as a chunk of its own, so it must be at least MIN_CHUNK_SIZE.
+static void* heap_alloc_aligned(size_t size, size_t align, size_t offset) {
+    if (USE_BUDDY) {
+        return buddy_alloc_aligned(size, align, offset);
+    }
+    
+    chunk_t* chunk = take_chunk(size + align + MIN_CHUNK_SIZE);
+    if (!chunk) {
+        return NULL;
+    }
+    
+    char* payload = (char*)chunk + HEADER_SIZE;
+    uintptr_t want = ((uintptr_t)payload - offset + align - 1) & ~(uintptr_t)(align - 1);
+    char* aligned = (char*)(want + offset);
+    while (aligned != payload && aligned - payload < MIN_CHUNK_SIZE) {
+        aligned += align;
+    }
+    
+    if (aligned != payload) {
+        size_t lead = aligned - payload;
+        chunk_t* moved = (chunk_t*)(aligned - HEADER_SIZE);
+        moved->size_and_flag = chunk_size(chunk) - lead;
+        set_free(chunk, lead - HEADER_SIZE);
+        insert_free(chunk);
+        chunk = moved;
     }
     
-    chunk->size_and_flag &= ~1; // mark free
+    return use_chunk(chunk, size);
+}
+
+// Carve n chunks of size payload bytes out of one free chunk big enough
+// for all of them, so there is one search instead of n. Each chunk but
+// the last gets its header written directly; the last one goes through
+// use_chunk, which puts back the tail. Called with the lock held,
+// returns 0 if no chunk that big could be found or mapped.
+static int heap_alloc_batch(size_t n, size_t size, void** ptrs) {
+    chunk_t* chunk = take_chunk(n * (size + HEADER_SIZE) - HEADER_SIZE);
+    if (!chunk) {
+        return 0;
+    }
     
-    coalesce(); // merge adjacent free chunks
-}
\ No newline at end of file
+    arena_t* arena = find_arena(chunk);
+    for (size_t i = 0; i < n - 1; i++) {
+        size_t rest = chunk_size(chunk) - size - HEADER_SIZE;
+        chunk->size_and_flag = size | (chunk->size_and_flag & PREV_FREE_BIT) | ALLOC_BIT;
+        set_chunk_used(arena, chunk, 1);
+        ptrs[i] = (char*)chunk + HEADER_SIZE;
+        
+        chunk = next_chunk(chunk);
+        chunk->size_and_flag = rest;
+    }
+    ptrs[n - 1] = use_chunk(chunk, size);
+    return 1;
+}
+
+// Free a chunk that passed checked_chunk. Called with the lock held.
+static void heap_free(chunk_t* chunk, arena_t* arena) {
+    chunk->size_and_flag &= ~(size_t)ALLOC_BIT; // mark free
+    set_chunk_used(arena, chunk, 0);
+    
+    if (USE_BUDDY) {
+        // an aligned block gives back the whole block it sits in
+        if (buddy_inner(chunk, arena)) {
+            chunk = (chunk_t*)((char*)chunk - *((size_t*)chunk - 1));
+            chunk->size_and_flag &= ~(size_t)ALLOC_BIT;
+            set_chunk_used(arena, chunk, 0);
+        }
+        chunk = buddy_merge(chunk, arena);
+        buddy_insert(chunk);
+        
+        if (arena != arenas && buddy_arena_empty(arena)) {
+            release_arena(arena);
+        }
+        return;
+    }
+    
+    chunk = merge_neighbours(chunk);
+    insert_free(chunk);
+    
+    // return arenas that are empty again, except the first one
+    if (arena != arenas && (char*)chunk == arena->bytes &&
+        HEADER_SIZE + chunk_size(chunk) == arena->length) {
+        release_arena(arena);
+    }
+}
+
+// Second half of myfree_batch. Every chunk in the batch has already been
+// marked with BATCH_BIT instead of being freed. This one takes in the
+// run of batch chunks after it and whatever free chunks sit on either
+// side, and lists the result once. A batch chunk in front of the run is
+// handled when its own turn comes, since it then finds a listed free
+// chunk after it. Called with the lock held.
+static void heap_merge_batch(chunk_t* chunk) {
+    size_t size = chunk_size(chunk);
+    chunk->size_and_flag &= ~(size_t)BATCH_BIT;
+    
+    chunk_t* next = next_chunk(chunk);
+    while ((next->size_and_flag & (ALLOC_BIT | BATCH_BIT)) == BATCH_BIT) {
+        next->size_and_flag &= ~(size_t)BATCH_BIT;
+        size += HEADER_SIZE + chunk_size(next);
+        next = next_chunk(next);
+        merges++;
+    }
+    
+    // now that the run is known, the ordinary merge finishes the job
+    set_free(chunk, size);
+    chunk = merge_neighbours(chunk);
+    insert_free(chunk);
+    
+    arena_t* arena = find_arena(chunk);
+    if (arena != arenas && (char*)chunk == arena->bytes &&
+        HEADER_SIZE + chunk_size(chunk) == arena->length) {
+        release_arena(arena);
+    }
+}
+
+// Block size, header included, that holds a size-byte payload
+static size_t buddy_block(size_t size) {
+    size_t block = size + HEADER_SIZE;
+    if (block <= ((size_t)1 << BUDDY_MIN_LOG2)) {
+        return (size_t)1 << BUDDY_MIN_LOG2;
+    }
+    return (size_t)1 << (fls_size(block - 1) + 1);
+}
+
+static void buddy_insert(chunk_t* chunk) {
+    int order = fls_size(chunk_size(chunk) + HEADER_SIZE);
+    
+    chunk->prev_free = NULL;
+    chunk->next_free = buddy_lists[order];
+    if (chunk->next_free) {
+        chunk->next_free->prev_free = chunk;
+    }
+    buddy_lists[order] = chunk;
+    buddy_bitmap |= 1ULL << order;
+}
+
+static void buddy_remove(chunk_t* chunk) {
+    int order = fls_size(chunk_size(chunk) + HEADER_SIZE);
+    
+    if (chunk->prev_free) {
+        chunk->prev_free->next_free = chunk->next_free;
+    } else {
+        buddy_lists[order] = chunk->next_free;
+    }
+    if (chunk->next_free) {
+        chunk->next_free->prev_free = chunk->prev_free;
+    }
+    if (!buddy_lists[order]) {
+        buddy_bitmap &= ~(1ULL << order);
+    }
+}
+
+// Cut a new arena into its top-level blocks, largest first, one for
+// each bit of its length. Each block's offset is then a multiple of its
+// size, and the block after the last one is the sentinel, so merging
+// never runs past the arena.
+static void buddy_add_arena(arena_t* arena) {
+    char* curr = arena->bytes;
+    
+    for (int order = BUDDY_ORDERS - 1; order >= BUDDY_MIN_LOG2; order--) {
+        size_t block = (size_t)1 << order;
+        if (arena->length & block) {
+            chunk_t* chunk = (chunk_t*)curr;
+            chunk->size_and_flag = block - HEADER_SIZE;
+            buddy_insert(chunk);
+            curr += block;
+        }
+    }
+}
+
+// An arena is empty when each of its top-level blocks is free and whole
+static int buddy_arena_empty(arena_t* arena) {
+    char* curr = arena->bytes;
+    
+    for (int order = BUDDY_ORDERS - 1; order >= BUDDY_MIN_LOG2; order--) {
+        size_t block = (size_t)1 << order;
+        if (arena->length & block) {
+            chunk_t* chunk = (chunk_t*)curr;
+            if ((chunk->size_and_flag & ALLOC_BIT) || chunk_size(chunk) + HEADER_SIZE != block) {
+                return 0;
+            }
+            curr += block;
+        }
+    }
+    return 1;
+}
+
+// Take the smallest free block that holds size bytes off its list,
+// splitting bigger blocks in half until it is the right size. Maps a
+// new arena when no block is big enough.
+static chunk_t* buddy_take(size_t size) {
+    size_t want = buddy_block(size);
+    int order = fls_size(want);
+    
+    searches++;
+    uint64_t orders = buddy_bitmap & (~0ULL << order);
+    if (!orders) {
+        if (!new_arena(size)) {
+            return NULL;
+        }
+        orders = buddy_bitmap & (~0ULL << order);
+    }
+    
+    int found = __builtin_ctzll(orders);
+    chunk_t* chunk = buddy_lists[found];
+    chunks_scanned++;
+    buddy_remove(chunk);
+    
+    if (found > order) {
+        // the split writes headers and links up to the first upper half
+        arena_t* arena = find_arena(chunk);
+        char* used = (char*)chunk + ((size_t)1 << (found - 1)) + HEADER_SIZE + 2 * sizeof(chunk_t*);
+        if (used > arena->fresh) {
+            arena->fresh = used;
+        }
+        
+        chunk->size_and_flag = ((size_t)1 << found) - HEADER_SIZE;
+        buddy_split(chunk, want);
+    }
+    
+    return chunk;
+}
+
+// Halve a block until it is down to block bytes, putting each upper half
+// on its list. The lower half stays allocated or taken, so the upper
+// half never has a free buddy to merge with.
+static void buddy_split(chunk_t* chunk, size_t block) {
+    size_t curr = chunk_size(chunk) + HEADER_SIZE;
+    size_t flags = chunk->size_and_flag & FLAG_MASK;
+    
+    while (curr / 2 >= block) {
+        curr /= 2;
+        chunk_t* upper = (chunk_t*)((char*)chunk + curr);
+        upper->size_and_flag = curr - HEADER_SIZE;
+        buddy_insert(upper);
+    }
+    
+    chunk->size_and_flag = (curr - HEADER_SIZE) | flags;
+}
+
+// Grow an allocated block in place by taking over its buddies. Only
+// works while the block is the lower half and each buddy is free and
+// whole, which is checked before anything is changed.
+static int buddy_grow(chunk_t* chunk, size_t size, arena_t* arena) {
+    size_t want = buddy_block(size);
+    size_t offset = (char*)chunk - arena->bytes;
+    size_t block = chunk_size(chunk) + HEADER_SIZE;
+    
+    for (size_t curr = block; curr < want; curr *= 2) {
+        chunk_t* buddy = (chunk_t*)((char*)chunk + curr);
+        if ((offset & curr) || (buddy->size_and_flag & ALLOC_BIT) ||
+            chunk_size(buddy) + HEADER_SIZE != curr) {
+            return 0;
+        }
+    }
+    
+    for (size_t curr = block; curr < want; curr *= 2) {
+        buddy_remove((chunk_t*)((char*)chunk + curr));
+    }
+    chunk->size_and_flag = (want - HEADER_SIZE) | (chunk->size_and_flag & FLAG_MASK);
+    
+    char* used = (char*)chunk + want;
+    if (used > arena->fresh) {
+        arena->fresh = used;
+    }
+    return 1;
+}
+
+// A block of at least align bytes starts on an align boundary, since
+// arenas are page aligned. That lines up the header, which is what slabs
+// ask for with offset HEADER_SIZE.
+//
+// A payload aligned past 8 bytes can never sit right after a block's
+// header, so it is placed inside a bigger block instead: it gets a
+// header of its own, off any block boundary, and the word in front of
+// that header holds the distance back to the block's real header. Both
+// headers are marked used, and free() finds the real one with
+// buddy_inner.
+static void* buddy_alloc_aligned(size_t size, size_t align, size_t offset) {
+    if (offset == HEADER_SIZE) {
+        if (align > page_size) {
+            return NULL;
+        }
+        
+        size_t block = buddy_block(size);
+        if (block < align) {
+            block = align;
+        }
+        
+        chunk_t* chunk = buddy_take(block - HEADER_SIZE);
+        if (!chunk) {
+            return NULL;
+        }
+        return use_chunk(chunk, block - HEADER_SIZE);
+    }
+    
+    // room for the outer header, the back distance and the inner header
+    // in front of the payload, wherever the aligned spot falls
+    chunk_t* chunk = buddy_take(size + align + 2 * HEADER_SIZE);
+    if (!chunk) {
+        return NULL;
+    }
+    
+    char* start = (char*)chunk;
+    char* end = start + HEADER_SIZE + chunk_size(chunk);
+    use_chunk(chunk, chunk_size(chunk));
+    
+    uintptr_t want = ((uintptr_t)start + 3 * HEADER_SIZE + align - 1) & ~(uintptr_t)(align - 1);
+    char* payload = (char*)want;
+    chunk_t* inner = (chunk_t*)(payload - HEADER_SIZE);
+    
+    *((size_t*)inner - 1) = (char*)inner - start;
+    inner->size_and_flag = (size_t)(end - payload) | ALLOC_BIT;
+    set_chunk_used(find_arena(chunk), inner, 1);
+    return payload;
+}
+
+// Whether chunk is the inner header of an aligned block, which is never
+// on a block boundary
+static int buddy_inner(chunk_t* chunk, arena_t* arena) {
+    return (((char*)chunk - arena->bytes) & (((size_t)1 << BUDDY_MIN_LOG2) - 1)) != 0;
+}
+
+// Merge a freed block with its buddy for as long as the buddy is free
+// and whole. The sentinel and the smaller top-level blocks never match,
+// so this stays inside the arena.
+static chunk_t* buddy_merge(chunk_t* chunk, arena_t* arena) {
+    size_t offset = (char*)chunk - arena->bytes;
+    size_t block = chunk_size(chunk) + HEADER_SIZE;
+    
+    while (1) {
+        chunk_t* buddy = (chunk_t*)(arena->bytes + (offset ^ block));
+        if ((buddy->size_and_flag & ALLOC_BIT) || chunk_size(buddy) + HEADER_SIZE != block) {
+            break;
+        }
+        
+        buddy_remove(buddy);
+        merges++;
+        offset &= ~block;
+        block *= 2;
+    }
+    
+    chunk = (chunk_t*)(arena->bytes + offset);
+    chunk->size_and_flag = block - HEADER_SIZE;
+    return chunk;
+}
+
+// Mark or clear an allocated chunk header in the arena's used map. Only
+// changed under the lock, but myfree reads it without one.
+static void set_chunk_used(arena_t* arena, chunk_t* chunk, int used) {
+    size_t bit = ((char*)chunk - arena->bytes) / HEADER_SIZE;
+    
+    if (used) {
+        __atomic_fetch_or(&arena->used_map[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&arena->used_map[bit / 64], ~(1ULL << (bit % 64)), __ATOMIC_RELAXED);
+    }
+}
+
+static int chunk_used(arena_t* arena, chunk_t* chunk) {
+    size_t bit = ((char*)chunk - arena->bytes) / HEADER_SIZE;
+    uint64_t word = __atomic_load_n(&arena->used_map[bit / 64], __ATOMIC_RELAXED);
+    
+    return (word >> (bit % 64)) & 1;
+}
+
+// Slab holding ptr, or NULL when ptr is in an ordinary chunk
+static slab_t* find_slab(arena_t* arena, void* ptr) {
+    size_t page = ((char*)ptr - arena->bytes) / SLAB_PAGE;
+    uint64_t word = __atomic_load_n(&arena->slab_map[page / 64], __ATOMIC_RELAXED);
+    
+    if (!((word >> (page % 64)) & 1)) {
+        return NULL;
+    }
+    return (slab_t*)(arena->bytes + page * SLAB_PAGE + HEADER_SIZE);
+}
+
+// Pop an object of class cls, cutting a new slab page if the class has
+// no slab with free objects. Called with the lock held.
+static void* slab_alloc(int cls) {
+    slab_t* slab = partial_slabs[cls];
+    
+    if (!slab) {
+        // the slab chunk, header included, fills exactly one SLAB_PAGE
+        // of the arena
+        slab = heap_alloc_aligned(SLAB_PAGE - HEADER_SIZE, SLAB_PAGE, ARENA_LEAD + HEADER_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        
+        arena_t* arena = find_arena(slab);
+        size_t page = ((char*)slab - arena->bytes) / SLAB_PAGE;
+        __atomic_fetch_or(&arena->slab_map[page / 64], 1ULL << (page % 64), __ATOMIC_RELAXED);
+        
+        slab->obj_size = 8 << cls;
+        slab->capacity = (SLAB_PAGE - HEADER_SIZE - SLAB_HEADER) / slab->obj_size;
+        slab->used = 0;
+        slab->used_map = 0;
+        slab->free_list = NULL;
+        
+        char* objects = (char*)slab + SLAB_HEADER;
+        for (int i = slab->capacity - 1; i >= 0; i--) {
+            void* obj = objects + (size_t)i * slab->obj_size;
+            *(void**)obj = slab->free_list;
+            slab->free_list = obj;
+        }
+        
+        slab->prev = NULL;
+        slab->next = NULL;
+        partial_slabs[cls] = slab;
+    }
+    
+    void* obj = slab->free_list;
+    slab->free_list = *(void**)obj;
+    
+    size_t index = ((char*)obj - ((char*)slab + SLAB_HEADER)) / slab->obj_size;
+    __atomic_fetch_or(&slab->used_map, 1ULL << index, __ATOMIC_RELAXED);
+    slab->used++;
+    
+    // a full slab leaves the partial list until an object comes back
+    if (!slab->free_list) {
+        partial_slabs[cls] = slab->next;
+        if (slab->next) {
+            slab->next->prev = NULL;
+        }
+    }
+    
+    return obj;
+}
+
+// Push an object back on its slab. An empty slab is returned to the heap
+// unless it is the only one its class has left. Called with the lock held.
+static void slab_free(slab_t* slab, arena_t* arena, void* ptr) {
+    int cls = __builtin_ctz(slab->obj_size) - 3;
+    size_t index = ((char*)ptr - ((char*)slab + SLAB_HEADER)) / slab->obj_size;
+    
+    __atomic_fetch_and(&slab->used_map, ~(1ULL << index), __ATOMIC_RELAXED);
+    
+    if (!slab->free_list) {
+        slab->prev = NULL;
+        slab->next = partial_slabs[cls];
+        if (slab->next) {
+            slab->next->prev = slab;
+        }
+        partial_slabs[cls] = slab;
+    }
+    
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->used--;
+    
+    if (slab->used == 0 && (slab->prev || slab->next)) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            partial_slabs[cls] = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+        
+        size_t page = ((char*)slab - arena->bytes) / SLAB_PAGE;
+        __atomic_fetch_and(&arena->slab_map[page / 64], ~(1ULL << (page % 64)), __ATOMIC_RELAXED);
+        heap_free((chunk_t*)((char*)slab - HEADER_SIZE), arena);
+    }
+}
+
+// Reuse a chunk of exactly size bytes from its quick list. Called with
+// the lock held, and only when the list is not empty.
+static void* quick_get(size_t size) {
+    quick_bin_t* bin = &quick_bins[size >> 3];
+    void* ptr = bin->head;
+    bin->head = *(void**)ptr;
+    bin->count--;
+    
+    chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+    set_chunk_used(find_arena(chunk), chunk, 1);
+    return ptr;
+}
+
+// Hold a freed chunk on its quick list instead of merging it. Returns 0
+// if quick lists are off or the chunk is too big for one. Called with
+// the lock held.
+static int quick_put(chunk_t* chunk, arena_t* arena) {
+    size_t size = chunk_size(chunk);
+    if (!quick_lists || size > QUICK_MAX) {
+        return 0;
+    }
+    
+    set_chunk_used(arena, chunk, 0);
+    
+    quick_bin_t* bin = &quick_bins[size >> 3];
+    void* ptr = (char*)chunk + HEADER_SIZE;
+    *(void**)ptr = bin->head;
+    bin->head = ptr;
+    if (++bin->count > QUICK_COUNT) {
+        quick_flush(bin);
+    }
+    return 1;
+}
+
+// Free every chunk on a quick list for real. Chunks next to each other
+// on the same list merge as the second one finds the first already free.
+static void quick_flush(quick_bin_t* bin) {
+    while (bin->head) {
+        chunk_t* chunk = (chunk_t*)((char*)bin->head - HEADER_SIZE);
+        bin->head = *(void**)bin->head;
+        heap_free(chunk, find_arena(chunk));
+    }
+    bin->count = 0;
+}
+
+// Flush all quick lists, returns 0 if they were all empty
+static int quick_flush_all(void) {
+    int flushed = 0;
+    
+    for (int i = 0; i < QUICK_BINS; i++) {
+        if (quick_bins[i].head) {
+            quick_flush(&quick_bins[i]);
+            flushed = 1;
+        }
+    }
+    return flushed;
+}
+
+// Allocate a block of a size that mymalloc has already rounded, from a
+// slab, a quick list or the chunk heap. Called with the lock held.
+static void* block_alloc(size_t size) {
+    if (size <= SLAB_MAX) {
+        return slab_alloc(__builtin_ctzll(size) - 3);
+    }
+    if (size <= QUICK_MAX && quick_bins[size >> 3].head) {
+        return quick_get(size);
+    }
+    return heap_alloc(size);
+}
+
+// Free a block that passed checked_block. Called with the lock held.
+static void block_free(void* ptr, arena_t* arena, slab_t* slab) {
+    chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+    
+    if (slab) {
+        slab_free(slab, arena, ptr);
+    } else if (!quick_put(chunk, arena)) {
+        heap_free(chunk, arena);
+    }
+}
+
+#ifdef THREADSAFE
+// Clear or set the used bit of a block going into or out of a thread
+// cache. A cached block then fails checked_block like a freed one, so
+// free() and realloc() from any thread reject it. Clearing is a single
+// atomic step and returns 0 if the bit was already clear, which means
+// the block has been freed twice.
+static int tcache_mark(void* ptr, arena_t* arena, slab_t* slab, int cached) {
+    uint64_t* word;
+    uint64_t bit;
+    
+    if (slab) {
+        size_t index = ((char*)ptr - ((char*)slab + SLAB_HEADER)) / slab->obj_size;
+        word = &slab->used_map;
+        bit = 1ULL << index;
+    } else {
+        size_t index = ((char*)ptr - HEADER_SIZE - arena->bytes) / HEADER_SIZE;
+        word = &arena->used_map[index / 64];
+        bit = 1ULL << (index % 64);
+    }
+    
+    if (cached) {
+        return (__atomic_fetch_and(word, ~bit, __ATOMIC_ACQ_REL) & bit) != 0;
+    }
+    __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Flush this thread's cache when it exits. Done the first time the
+// thread touches its cache, whether to allocate or to free.
+static void tcache_register(void) {
+    if (!tcache_registered) {
+        tcache_registered = 1;
+        pthread_setspecific(tcache_key, tcache);
+    }
+}
+
+// Take a cached block of this exact payload size. An empty bin is
+// refilled with a batch of blocks under a single lock.
+static void* tcache_get(size_t size) {
+    tcache_bin_t* bin = &tcache[size >> 3];
+    
+    if (!bin->head) {
+        LOCK();
+        if (!initialized) {
+            init_heap();
+        }
+        for (int i = 0; i < TCACHE_BATCH; i++) {
+            void* p = block_alloc(size);
+            if (!p) {
+                break;
+            }
+            arena_t* arena = find_arena(p);
+            tcache_mark(p, arena, find_slab(arena, p), 1);
+            *(void**)p = bin->head;
+            bin->head = p;
+            bin->count++;
+        }
+        UNLOCK();
+        
+        tcache_register();
+        
+        if (!bin->head) {
+            return NULL;
+        }
+    }
+    
+    void* p = bin->head;
+    bin->head = *(void**)p;
+    bin->count--;
+    
+    arena_t* arena = find_arena(p);
+    tcache_mark(p, arena, find_slab(arena, p), 0);
+    return p;
+}
+
+// Hand blocks from the front of a bin back to the heap
+static void tcache_flush(tcache_bin_t* bin, int n) {
+    LOCK();
+    while (bin->head && n-- > 0) {
+        void* p = bin->head;
+        bin->head = *(void**)p;
+        bin->count--;
+        
+        arena_t* arena = find_arena(p);
+        block_free(p, arena, find_slab(arena, p));
+    }
+    UNLOCK();
+}
+
+// Cache a block that passed checked_block. Returns 0 if another free of
+// the same block got there first.
+static int tcache_put(void* ptr, size_t size, arena_t* arena, slab_t* slab) {
+    tcache_bin_t* bin = &tcache[size >> 3];
+    
+    if (!tcache_mark(ptr, arena, slab, 1)) {
+        return 0;
+    }
+    
+    tcache_register();
+    
+    if (bin->count >= TCACHE_COUNT) {
+        tcache_flush(bin, TCACHE_BATCH);
+    }
+    
+    *(void**)ptr = bin->head;
+    bin->head = ptr;
+    bin->count++;
+    return 1;
+}
+
+// Thread exit destructor, also run for the main thread before the leak check
+static void tcache_release(void* cache) {
+    tcache_bin_t* bins = cache;
+    
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        tcache_flush(&bins[i], bins[i].count);
+    }
+}
+
+// fork() copies only the calling thread, so a lock another thread held
+// at that moment would stay locked in the child for good. Both locks are
+// taken around the fork, the trace lock first as everywhere else, and
+// released again in the parent and the child.
+static void fork_prepare(void) {
+    trace_lock();
+    LOCK();
+}
+
+static void fork_release(void) {
+    UNLOCK();
+    trace_unlock();
+}
+#endif
+
+// Check if pointer is valid
+static int valid_ptr(void* ptr) {
+    if (!find_arena(ptr)) {
+        return 0;
+    }
+    
+    // check alignment
+    if ((uintptr_t)ptr % 8 != 0) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+// Size of the block that ptr was returned for, or 0 if ptr was not
+// returned by mymalloc or has already been freed. Also finds the arena,
+// and the slab when ptr is a slab object.
+static size_t checked_block(void* ptr, arena_t** arena, slab_t** slab) {
+    if (!valid_ptr(ptr)) {
+        return 0;
+    }
+    
+    *arena = find_arena(ptr);
+    *slab = find_slab(*arena, ptr);
+    
+    // slab objects must sit on an object boundary and be handed out
+    if (*slab) {
+        char* objects = (char*)*slab + SLAB_HEADER;
+        if ((char*)ptr < objects) {
+            return 0;
+        }
+        
+        size_t offset = (char*)ptr - objects;
+        size_t index = offset / (*slab)->obj_size;
+        if (offset % (*slab)->obj_size != 0 || index >= (*slab)->capacity) {
+            return 0;
+        }
+        
+        uint64_t used = __atomic_load_n(&(*slab)->used_map, __ATOMIC_RELAXED);
+        if (!((used >> index) & 1)) {
+            return 0;
+        }
+        return (*slab)->obj_size;
+    }
+    
+    chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+    
+    if ((char*)chunk < (*arena)->bytes) {
+        return 0;
+    }
+    
+    // the used map says whether an allocated chunk starts here, so
+    // interior and already freed pointers are caught with one bit test
+    // and never get the bytes in front of them read as a header
+    if (!chunk_used(*arena, chunk)) {
+        return 0;
+    }
+    
+    size_t header = __atomic_load_n(&chunk->size_and_flag, __ATOMIC_RELAXED);
+    return header & ~(size_t)FLAG_MASK;
+}
+
+// Round a payload size up so the chunk after it starts ARENA_LEAD bytes
+// past an ALIGNMENT boundary, as the arena's first chunk does
+static size_t round_payload(size_t size) {
+    return ((size + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1)) - HEADER_SIZE;
+}
+
+// Round a request up to the size block_alloc is asked for: small
+// requests go to a slab class, the rest to round_payload
+static size_t request_size(size_t size) {
+    if (size <= SLAB_MAX) {
+        return size <= ALIGNMENT ? ALIGNMENT : (size_t)1 << (fls_size(size - 1) + 1);
+    }
+    return round_payload(size);
+}
+
+// Walk every arena and add up the live blocks, the free chunks and the
+// blocks in thread caches. Slab objects count at their class size; the
+// unused part of a slab is neither live nor free. Called with the lock
+// held.
+static void heap_usage(mymalloc_stats_t* stats) {
+    stats->live_bytes = 0;
+    stats->live_objects = 0;
+    stats->free_bytes = 0;
+    stats->free_chunks = 0;
+    stats->largest_free = 0;
+    stats->cached_bytes = 0;
+    stats->cached_objects = 0;
+    
+    for (arena_t* a = arenas; a; a = a->next) {
+        char* curr = a->bytes;
+        char* end = a->bytes + a->length;
+        
+        while (curr < end) {
+            chunk_t* chunk = (chunk_t*)curr;
+            size_t size = chunk_size(chunk);
+            
+            if (size == 0) break;
+            
+            if ((chunk->size_and_flag & ALLOC_BIT) && chunk_used(a, chunk)) {
+                slab_t* slab = find_slab(a, curr + HEADER_SIZE);
+                
+                if (slab) {
+                    // a cached object is handed out by the slab but its
+                    // bit is clear
+                    int used = __builtin_popcountll(slab->used_map);
+                    stats->live_objects += used;
+                    stats->live_bytes += (size_t)used * slab->obj_size;
+                    stats->cached_objects += slab->used - used;
+                    stats->cached_bytes += (size_t)(slab->used - used) * slab->obj_size;
+                } else {
+                    stats->live_objects++;
+                    stats->live_bytes += size;
+                }
+            } else if (chunk->size_and_flag & ALLOC_BIT) {
+                // allocated but not used: on a quick list or in a thread
+                // cache, told apart below
+                stats->cached_objects++;
+                stats->cached_bytes += size;
+            } else {
+                stats->free_chunks++;
+                stats->free_bytes += size;
+                if (size > stats->largest_free) {
+                    stats->largest_free = size;
+                }
+            }
+            
+            curr += HEADER_SIZE + size;
+        }
+    }
+    
+    // quick list chunks can be handed out to any request, so they count
+    // as free, and each list holds chunks of exactly one size
+    for (size_t i = 0; i < QUICK_BINS; i++) {
+        size_t count = quick_bins[i].count;
+        stats->cached_objects -= count;
+        stats->cached_bytes -= count * (i << 3);
+        stats->free_chunks += count;
+        stats->free_bytes += count * (i << 3);
+        if (count && (i << 3) > stats->largest_free) {
+            stats->largest_free = i << 3;
+        }
+    }
+}
+
+// Check for leaks at exit
+static void check_leaks(void) {
+    mymalloc_stats_t stats;
+    
+#ifdef THREADSAFE
+    tcache_release(tcache);
+#endif
+    
+    if (leak_report) {
+        LOCK();
+        heap_usage(&stats);
+        region_leaks(&stats);
+        UNLOCK();
+        
+        if (stats.live_objects > 0) {
+            fprintf(stderr, "mymalloc: %zu bytes leaked in %zu objects.\n", 
+                    stats.live_bytes, stats.live_objects);
+        }
+    }
+    profile_report();
+}
+
+// Report each region still alive as one leak, and take its blocks out of
+// the object count so they are not reported again one by one. Called
+// with the lock held.
+static void region_leaks(mymalloc_stats_t* stats) {
+    arena_t* arena;
+    slab_t* slab;
+    
+    for (region_t* region = regions; region; region = region->next) {
+        fprintf(stderr, "mymalloc: region from %s:%d leaked, %zu bytes in %zu objects.\n", 
+                region->file, region->line, region->bytes, region->objects);
+        
+        stats->live_bytes -= checked_block(region, &arena, &slab);
+        stats->live_objects--;
+        for (region_block_t* block = region->head.next; block; block = block->next) {
+            stats->live_bytes -= checked_block(block, &arena, &slab);
+            stats->live_objects--;
+        }
+    }
+}
+
+// SIGUSR1 handler, the stats are printed by the next call into the
+// allocator where it is safe to take the lock
+static void request_stats(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+static void print_stats_at_exit(void) {
+    mymalloc_stats_print();
+}
+
+// Count a public call, and print the stats if a signal asked for them
+static void count_call(size_t* counter) {
+    COUNT(*counter);
+    if (stats_requested) {
+        stats_requested = 0;
+        mymalloc_stats_print();
+    }
+}
+
+static void count_failure(void) {
+    COUNT(failed_calls);
+    if (stats_enabled) {
+        mymalloc_stats_print();
+    }
+}
+
+static void* alloc_request(size_t size, char* file, int line) {
+    if (size == 0) {
+        return NULL;
+    }
+    
+    if (size > MAX_REQUEST) {
+        fprintf(stderr, "malloc: Unable to allocate %zu bytes (%s:%d)\n", 
+                size, file, line);
+        return NULL;
+    }
+    
+    size_t aligned = request_size(size);
+    
+    void* ptr = NULL;
+    
+#ifdef THREADSAFE
+    if (aligned <= TCACHE_MAX_SIZE) {
+        ptr = tcache_get(aligned);
+    }
+#endif
+    
+    if (!ptr) {
+        LOCK();
+        if (!initialized) {
+            init_heap();
+        }
+        ptr = block_alloc(aligned);
+        UNLOCK();
+    }
+    
+    if (!ptr) {
+        fprintf(stderr, "malloc: Unable to allocate %zu bytes (%s:%d)\n", 
+                size, file, line);
+    }
+    
+    return ptr;
+}
+
+static void free_request(void* ptr, char* file, int line) {
+    if (ptr == NULL) {
+        return;
+    }
+    
+    arena_t* arena;
+    slab_t* slab;
+    size_t size = checked_block(ptr, &arena, &slab);
+    
+    if (size == 0) {
+        fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
+        exit(2);
+    }
+    
+#ifdef THREADSAFE
+    // two frees of the same block racing here are told apart by
+    // tcache_put, which clears the used bit atomically. An aligned block
+    // in the buddy build is not a whole block, so it is never cached.
+    chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+    if (size <= TCACHE_MAX_SIZE && (slab || !USE_BUDDY || !buddy_inner(chunk, arena))) {
+        if (!tcache_put(ptr, size, arena, slab)) {
+            fprintf(stderr, "free: Inappropriate pointer (%s:%d)\n", file, line);
+            exit(2);
+        }
+        return;
+    }
+#endif
+    
+    LOCK();
+    block_free(ptr, arena, slab);
+    UNLOCK();
+}
+
+static void* realloc_request(void* ptr, size_t size, char* file, int line) {
+    if (ptr == NULL) {
+        return alloc_request(size, file, line);
+    }
+    
+    if (size == 0) {
+        free_request(ptr, file, line);
+        return NULL;
+    }
+    
+    arena_t* arena;
+    slab_t* slab;
+    size_t old_size = checked_block(ptr, &arena, &slab);
+    
+    if (old_size == 0) {
+        fprintf(stderr, "realloc: Inappropriate pointer (%s:%d)\n", file, line);
+        exit(2);
+    }
+    
+    if (size > MAX_REQUEST) {
+        fprintf(stderr, "realloc: Unable to allocate %zu bytes (%s:%d)\n", 
+                size, file, line);
+        return NULL;
+    }
+    
+    size_t aligned = request_size(size);
+    
+    // a slab object keeps its place while the request stays in its class
+    if (slab && aligned == old_size) {
+        return ptr;
+    }
+    
+    // chunks shrink by splitting off the tail and grow into a free next
+    // chunk, both without copying. A chunk stays a chunk, so it is
+    // rounded as one even below SLAB_MAX.
+    if (!slab) {
+        aligned = round_payload(size);
+        if (aligned < 2 * sizeof(chunk_t*) + FOOTER_SIZE) {
+            aligned = 2 * sizeof(chunk_t*) + FOOTER_SIZE;
+        }
+        
+        int in_place = 0;
+        chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+        
+        LOCK();
+        if (aligned <= old_size) {
+            shrink_chunk(chunk, aligned, arena);
+            in_place = 1;
+        } else {
+            in_place = grow_chunk(chunk, aligned, arena);
+        }
+        UNLOCK();
+        
+        if (in_place) {
+            return ptr;
+        }
+    }
+    
+    // last resort, move the block
+    void* moved = alloc_request(size, file, line);
+    if (!moved) {
+        return NULL;
+    }
+    
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    free_request(ptr, file, line);
+    return moved;
+}
+
+static void* calloc_request(size_t count, size_t size, char* file, int line) {
+    if (count == 0 || size == 0) {
+        return NULL;
+    }
+    
+    if (size > MAX_REQUEST / count) {
+        fprintf(stderr, "calloc: Unable to allocate %zu * %zu bytes (%s:%d)\n", 
+                count, size, file, line);
+        return NULL;
+    }
+    
+    size_t total = count * size;
+    size_t aligned = request_size(total);
+    
+    // small blocks may be recycled, just clear them
+    if (aligned <= SLAB_MAX
+#ifdef THREADSAFE
+        || aligned <= TCACHE_MAX_SIZE
+#endif
+        ) {
+        void* ptr = alloc_request(total, file, line);
+        if (ptr) {
+            memset(ptr, 0, total);
+        }
+        return ptr;
+    }
+    
+    // a chunk only needs clearing below the arena's fresh mark, which
+    // mmap handed us zeroed. Past it only the free list links at the
+    // start and a footer at the very end of the arena can be dirty.
+    LOCK();
+    if (!initialized) {
+        init_heap();
+    }
+    
+    char* ptr = NULL;
+    char* fresh = NULL;
+    size_t payload = 0;
+    int at_end = 0;
+    chunk_t* chunk = take_chunk(aligned);
+    
+    if (chunk) {
+        fresh = find_arena(chunk)->fresh;
+        ptr = use_chunk(chunk, aligned);
+        payload = chunk_size(chunk);
+        at_end = chunk_size(next_chunk(chunk)) == 0;
+    }
+    UNLOCK();
+    
+    if (!ptr) {
+        fprintf(stderr, "calloc: Unable to allocate %zu * %zu bytes (%s:%d)\n", 
+                count, size, file, line);
+        return NULL;
+    }
+    
+    char* end = ptr + total;
+    memset(ptr, 0, 2 * sizeof(chunk_t*));
+    if (fresh > ptr) {
+        memset(ptr, 0, (fresh < end ? fresh : end) - ptr);
+    }
+    if (at_end) {
+        memset(ptr + payload - FOOTER_SIZE, 0, FOOTER_SIZE);
+    }
+    
+    return ptr;
+}
+
+// Chunks are only 8-byte aligned, so anything stricter is carved out of
+// a bigger free chunk by heap_alloc_aligned, which puts the slack in
+// front of the aligned spot back on the free lists. The result is an
+// ordinary chunk, so myfree needs nothing special.
+static void* aligned_request(size_t alignment, size_t size, char* file, int line) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        fprintf(stderr, "aligned_alloc: Alignment %zu is not a power of two (%s:%d)\n",
+                alignment, file, line);
+        return NULL;
+    }
+    
+    if (alignment <= 8) {
+        return alloc_request(size, file, line);
+    }
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    if (size > MAX_REQUEST || alignment > MAX_REQUEST) {
+        fprintf(stderr, "aligned_alloc: Unable to allocate %zu bytes (%s:%d)\n", 
+                size, file, line);
+        return NULL;
+    }
+    
+    size_t aligned = round_payload(size);
+    if (aligned < 2 * sizeof(chunk_t*) + FOOTER_SIZE) {
+        aligned = 2 * sizeof(chunk_t*) + FOOTER_SIZE;
+    }
+    
+    LOCK();
+    if (!initialized) {
+        init_heap();
+    }
+    void* ptr = heap_alloc_aligned(aligned, alignment, 0);
+    UNLOCK();
+    
+    if (!ptr) {
+        fprintf(stderr, "aligned_alloc: Unable to allocate %zu bytes aligned to %zu (%s:%d)\n", 
+                size, alignment, file, line);
+    }
+    
+    return ptr;
+}
+
+// Allocate n blocks of one size into ptrs under a single lock. Chunks
+// come out of one free chunk in one search; slab objects and buddy
+// blocks have no search to save, so they are just taken in a loop.
+// Returns n, or 0 with nothing allocated.
+static size_t alloc_batch_request(size_t n, size_t size, void** ptrs, char* file, int line) {
+    if (n == 0 || size == 0) {
+        return 0;
+    }
+    
+    if (size > MAX_REQUEST || n > MAX_REQUEST / (size + HEADER_SIZE)) {
+        fprintf(stderr, "malloc_batch: Unable to allocate %zu blocks of %zu bytes (%s:%d)\n", 
+                n, size, file, line);
+        return 0;
+    }
+    
+    size_t aligned = request_size(size);
+    size_t done = 0;
+    
+    LOCK();
+    if (!initialized) {
+        init_heap();
+    }
+    if (aligned > SLAB_MAX && !USE_BUDDY) {
+        if (heap_alloc_batch(n, aligned, ptrs)) {
+            done = n;
+        }
+    } else {
+        while (done < n && (ptrs[done] = block_alloc(aligned))) {
+            done++;
+        }
+        if (done < n) {
+            // all or nothing, so hand back what was taken
+            for (size_t i = 0; i < done; i++) {
+                arena_t* arena = find_arena(ptrs[i]);
+                block_free(ptrs[i], arena, find_slab(arena, ptrs[i]));
+            }
+            done = 0;
+        }
+    }
+    UNLOCK();
+    
+    if (done == 0) {
+        fprintf(stderr, "malloc_batch: Unable to allocate %zu blocks of %zu bytes (%s:%d)\n", 
+                n, size, file, line);
+    }
+    
+    return done;
+}
+
+// Free n blocks under a single lock. Every pointer is checked the same
+// way free() checks it, and its used bit is cleared straight away so a
+// pointer that shows up twice is caught. Chunks are only marked in the
+// first pass, so a run of neighbours freed together is merged and listed
+// once in the second pass rather than once per chunk. Slab objects are
+// put back last, because an emptied slab is itself freed as a chunk and
+// must not land among chunks that are marked but not yet merged. The
+// buddy build frees chunk by chunk, since a buddy merge only ever looks
+// at one block. NULL entries are skipped.
+static void free_batch_request(void** ptrs, size_t n, char* file, int line) {
+    arena_t* arena;
+    slab_t* slab;
+    
+    LOCK();
+    for (size_t i = 0; i < n; i++) {
+        void* ptr = ptrs[i];
+        if (ptr == NULL) {
+            continue;
+        }
+        
+        size_t size = checked_block(ptr, &arena, &slab);
+        if (size == 0) {
+            UNLOCK();
+            fprintf(stderr, "free_batch: Inappropriate pointer (%s:%d)\n", file, line);
+            exit(2);
+        }
+        
+        if (slab) {
+            size_t index = ((char*)ptr - ((char*)slab + SLAB_HEADER)) / slab->obj_size;
+            __atomic_fetch_and(&slab->used_map, ~(1ULL << index), __ATOMIC_RELAXED);
+        } else if (USE_BUDDY) {
+            block_free(ptr, arena, slab);
+        } else {
+            chunk_t* chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+            chunk->size_and_flag = (chunk->size_and_flag & ~(size_t)ALLOC_BIT) | BATCH_BIT;
+            set_chunk_used(arena, chunk, 0);
+        }
+    }
+    
+    for (size_t i = 0; i < n && !USE_BUDDY; i++) {
+        // a merge may already have taken the chunk in, or given back
+        // its whole arena
+        if (ptrs[i] && (arena = find_arena(ptrs[i])) && !find_slab(arena, ptrs[i])) {
+            chunk_t* chunk = (chunk_t*)((char*)ptrs[i] - HEADER_SIZE);
+            if (chunk->size_and_flag & BATCH_BIT) {
+                heap_merge_batch(chunk);
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i] && (arena = find_arena(ptrs[i])) && (slab = find_slab(arena, ptrs[i]))) {
+            slab_free(slab, arena, ptrs[i]);
+        }
+    }
+    UNLOCK();
+}
+
+// Whether calls are being traced or profiled. Both read the environment
+// the first time, so ask both.
+static int watching(void) {
+    int traced = trace_enabled();
+    int profiled = profile_enabled();
+    return traced || profiled;
+}
+
+// The public entry points add counting, tracing and profiling. While
+// calls are watched each one holds the trace lock, so the records come
+// out in an order the heap could really have seen and the profile's
+// tables need no lock of their own.
+void* mymalloc(size_t size, char* file, int line) {
+    void* ptr;
+    count_call(&malloc_calls);
+    
+    if (!watching()) {
+        ptr = alloc_request(size, file, line);
+    } else {
+        trace_lock();
+        uint64_t start = profile_clock();
+        ptr = alloc_request(size, file, line);
+        profile_alloc(ptr, size, profile_clock() - start, file, line);
+        trace_event(TRACE_MALLOC, ptr, NULL, size, file, line);
+        trace_unlock();
+    }
+    
+    if (!ptr && size > 0) {
+        count_failure();
+    }
+    return ptr;
+}
+
+void myfree(void* ptr, char* file, int line) {
+    if (ptr == NULL) {
+        return;
+    }
+    count_call(&free_calls);
+    
+    if (!watching()) {
+        free_request(ptr, file, line);
+        return;
+    }
+    
+    trace_lock();
+    trace_event(TRACE_FREE, NULL, ptr, 0, file, line);
+    uint64_t start = profile_clock();
+    free_request(ptr, file, line);
+    profile_free(ptr, profile_clock() - start, file, line);
+    trace_unlock();
+}
+
+void* myrealloc(void* ptr, size_t size, char* file, int line) {
+    void* new_ptr;
+    count_call(&realloc_calls);
+    
+    if (!watching()) {
+        new_ptr = realloc_request(ptr, size, file, line);
+    } else {
+        trace_lock();
+        uint64_t start = profile_clock();
+        new_ptr = realloc_request(ptr, size, file, line);
+        profile_realloc(new_ptr, ptr, size, profile_clock() - start, file, line);
+        trace_event(TRACE_REALLOC, new_ptr, ptr, size, file, line);
+        trace_unlock();
+    }
+    
+    if (!new_ptr && size > 0) {
+        count_failure();
+    }
+    return new_ptr;
+}
+
+void* mycalloc(size_t count, size_t size, char* file, int line) {
+    void* ptr;
+    count_call(&malloc_calls);
+    
+    if (!watching()) {
+        ptr = calloc_request(count, size, file, line);
+    } else {
+        trace_lock();
+        uint64_t start = profile_clock();
+        ptr = calloc_request(count, size, file, line);
+        profile_alloc(ptr, count * size, profile_clock() - start, file, line);
+        trace_event(TRACE_CALLOC, ptr, NULL, count * size, file, line);
+        trace_unlock();
+    }
+    
+    if (!ptr && count > 0 && size > 0) {
+        count_failure();
+    }
+    return ptr;
+}
+
+void* myaligned_alloc(size_t alignment, size_t size, char* file, int line) {
+    void* ptr;
+    count_call(&malloc_calls);
+    
+    if (!watching()) {
+        ptr = aligned_request(alignment, size, file, line);
+    } else {
+        trace_lock();
+        uint64_t start = profile_clock();
+        ptr = aligned_request(alignment, size, file, line);
+        profile_alloc(ptr, size, profile_clock() - start, file, line);
+        trace_aligned(ptr, alignment, size, file, line);
+        trace_unlock();
+    }
+    
+    if (!ptr && size > 0) {
+        count_failure();
+    }
+    return ptr;
+}
+
+size_t mymalloc_batch(size_t n, size_t size, void** ptrs, char* file, int line) {
+    size_t done;
+    count_call(&malloc_calls);
+    if (n > 1) {
+        COUNT_N(malloc_calls, n - 1);
+    }
+    
+    if (!watching()) {
+        done = alloc_batch_request(n, size, ptrs, file, line);
+    } else {
+        // the profile charges each block an equal share of the time
+        trace_lock();
+        uint64_t start = profile_clock();
+        done = alloc_batch_request(n, size, ptrs, file, line);
+        uint64_t share = done ? (profile_clock() - start) / done : 0;
+        for (size_t i = 0; i < done; i++) {
+            profile_alloc(ptrs[i], size, share, file, line);
+            trace_event(TRACE_MALLOC, ptrs[i], NULL, size, file, line);
+        }
+        trace_unlock();
+    }
+    
+    if (done == 0 && n > 0 && size > 0) {
+        count_failure();
+    }
+    return done;
+}
+
+void myfree_batch(void** ptrs, size_t n, char* file, int line) {
+    count_call(&free_calls);
+    if (n > 1) {
+        COUNT_N(free_calls, n - 1);
+    }
+    
+    if (!watching()) {
+        free_batch_request(ptrs, n, file, line);
+        return;
+    }
+    
+    trace_lock();
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i]) {
+            trace_event(TRACE_FREE, NULL, ptrs[i], 0, file, line);
+        }
+    }
+    uint64_t start = profile_clock();
+    free_batch_request(ptrs, n, file, line);
+    uint64_t share = n ? (profile_clock() - start) / n : 0;
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i]) {
+            profile_free(ptrs[i], share, file, line);
+        }
+    }
+    trace_unlock();
+}
+
+int mymalloc_set_policy(int new_policy) {
+    if (USE_BUDDY || new_policy < MYMALLOC_TLSF || new_policy > MYMALLOC_BEST_FIT) {
+        return -1;
+    }
+    
+    LOCK();
+    int old = policy;
+    policy = new_policy;
+    rover = NULL;
+    UNLOCK();
+    
+    return old;
+}
+
+int mymalloc_set_quick_lists(int enabled) {
+    if (USE_BUDDY) {
+        return -1;
+    }
+    
+    LOCK();
+    int old = quick_lists;
+    quick_lists = enabled != 0;
+    if (!quick_lists) {
+        quick_flush_all();
+    }
+    UNLOCK();
+    
+    return old;
+}
+
+void mymalloc_stats(mymalloc_stats_t* stats) {
+    LOCK();
+    stats->heap_bytes = heap_bytes;
+    stats->peak_heap_bytes = peak_heap_bytes;
+    heap_usage(stats);
+    stats->merges = merges;
+    stats->avg_scanned = searches ? (double)chunks_scanned / searches : 0;
+    UNLOCK();
+    
+    stats->fragmentation = stats->free_bytes ?
+        1 - (double)stats->largest_free / stats->free_bytes : 0;
+    stats->malloc_calls = __atomic_load_n(&malloc_calls, __ATOMIC_RELAXED);
+    stats->realloc_calls = __atomic_load_n(&realloc_calls, __ATOMIC_RELAXED);
+    stats->free_calls = __atomic_load_n(&free_calls, __ATOMIC_RELAXED);
+    stats->failed_calls = __atomic_load_n(&failed_calls, __ATOMIC_RELAXED);
+}
+
+void mymalloc_stats_print(void) {
+    mymalloc_stats_t stats;
+    mymalloc_stats(&stats);
+    
+    fprintf(stderr, "mymalloc stats:\n");
+    fprintf(stderr, "  heap: %zu bytes mapped, peak %zu\n", 
+            stats.heap_bytes, stats.peak_heap_bytes);
+    fprintf(stderr, "  live: %zu bytes in %zu objects\n", 
+            stats.live_bytes, stats.live_objects);
+    fprintf(stderr, "  free: %zu bytes in %zu chunks, largest %zu, fragmentation %.1f%%\n",
+            stats.free_bytes, stats.free_chunks, stats.largest_free, 
+            stats.fragmentation * 100);
+#ifdef THREADSAFE
+    fprintf(stderr, "  cached: %zu bytes in %zu objects\n", 
+            stats.cached_bytes, stats.cached_objects);
+#endif
+    fprintf(stderr, "  calls: %zu malloc, %zu realloc, %zu free, %zu failed\n",
+            stats.malloc_calls, stats.realloc_calls, stats.free_calls, stats.failed_calls);
+    fprintf(stderr, "  merges: %zu, chunks scanned per search: %.2f\n",
+            stats.merges, stats.avg_scanned);
+}
+
+// Write the heap layout to path, see mysnapshot.h. Everything goes out
+// with write() from the stack, so it works even when the heap is in a
+// bad way, and it holds the lock for the whole walk, so the layout is
+// one the heap really had. Returns 0, or -1 if the file could not be
+// written.
+int mymalloc_snapshot(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    snapshot_writer_t w;
+    memset(&w, 0, offsetof(snapshot_writer_t, records));
+    w.fd = fd;
+    
+    snapshot_header_t header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION};
+    w.failed = write_all(fd, &header, sizeof(header));
+    
+    // the trace lock is always taken before the heap lock
+    int traced = trace_enabled();
+    if (traced) {
+        trace_lock();
+    }
+    LOCK();
+    
+    uint64_t number = 0;
+    for (arena_t* a = arenas; a; a = a->next, number++) {
+        snapshot_record_t* rec = snapshot_next(&w);
+        memset(rec, 0, sizeof(*rec));
+        rec->type = SNAPSHOT_ARENA;
+        rec->offset = number;
+        rec->size = a->length;
+        
+        chunk_t* chunk = (chunk_t*)a->bytes;
+        while (chunk_size(chunk) > 0) {
+            snapshot_chunk(&w, a, chunk, traced);
+            chunk = next_chunk(chunk);
+        }
+    }
+    
+    UNLOCK();
+    if (traced) {
+        trace_unlock();
+    }
+    
+    snapshot_flush(&w);
+    if (close(fd) != 0) {
+        w.failed = -1;
+    }
+    return w.failed;
+}
+
+static int write_all(int fd, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static snapshot_record_t* snapshot_next(snapshot_writer_t* w) {
+    if (w->buffered == SNAPSHOT_BUFFER) {
+        snapshot_flush(w);
+    }
+    return &w->records[w->buffered++];
+}
+
+static void snapshot_flush(snapshot_writer_t* w) {
+    if (w->buffered > 0 && write_all(w->fd, w->records, w->buffered * sizeof(snapshot_record_t)) != 0) {
+        w->failed = -1;
+    }
+    w->buffered = 0;
+}
+
+// One chunk record, preceded by a site record the first time its file
+// shows up. Called with the lock held.
+static void snapshot_chunk(snapshot_writer_t* w, arena_t* arena, chunk_t* chunk, int traced) {
+    char* payload = (char*)chunk + HEADER_SIZE;
+    size_t flags = chunk->size_and_flag;
+    int state = SNAPSHOT_USED;
+    
+    if (!(flags & ALLOC_BIT)) {
+        state = SNAPSHOT_FREE;
+    } else if (!chunk_used(arena, chunk)) {
+        state = SNAPSHOT_QUICK;
+    } else if (find_slab(arena, payload)) {
+        state = SNAPSHOT_SLAB;
+    } else if (flags & HANDLE_BIT) {
+        state = SNAPSHOT_HANDLE;
+    }
+    
+    int site = -1;
+    int line = 0;
+    const char* file = NULL;
+    if (traced && state == SNAPSHOT_USED) {
+        file = trace_site(payload, &site, &line);
+    }
+    
+    if (file && site < SNAPSHOT_SITES && !((w->named[site / 64] >> (site % 64)) & 1)) {
+        size_t length = strlen(file);
+        snapshot_record_t* rec = snapshot_next(w);
+        memset(rec, 0, sizeof(*rec));
+        rec->type = SNAPSHOT_SITE;
+        rec->site = site + 1;
+        rec->line = length;
+        snapshot_flush(w);
+        if (write_all(w->fd, file, length) != 0) {
+            w->failed = -1;
+        }
+        w->named[site / 64] |= 1ULL << (site % 64);
+    }
+    
+    snapshot_record_t* rec = snapshot_next(w);
+    rec->type = SNAPSHOT_CHUNK;
+    rec->state = state;
+    rec->site = file && site < SNAPSHOT_SITES ? site + 1 : 0;
+    rec->line = file ? line : 0;
+    rec->offset = (char*)chunk - arena->bytes;
+    rec->size = chunk_size(chunk);
+}
+
+// Regions take their blocks with the ordinary entry points, under the
+// site that created them, so they show up in traces and stats like any
+// other allocation. Only the list of live regions needs the lock.
+region_t* myregion_create(size_t block_size, char* file, int line) {
+    region_t* region = mymalloc(sizeof(region_t), file, line);
+    if (!region) {
+        return NULL;
+    }
+    
+    region->head.next = NULL;
+    region->head.size = 0;
+    region->current = &region->head;
+    region->top = NULL;
+    region->end = NULL;
+    region->block_size = block_size ? (block_size + 7) & ~(size_t)7 : REGION_BLOCK;
+    region->objects = 0;
+    region->bytes = 0;
+    region->file = file;
+    region->line = line;
+    
+    LOCK();
+    region->prev = NULL;
+    region->next = regions;
+    if (regions) {
+        regions->prev = region;
+    }
+    regions = region;
+    UNLOCK();
+    
+    return region;
+}
+
+// Move on to a block with room for size bytes: the next one kept by an
+// earlier reset if it is big enough, otherwise a new one linked in after
+// the current block. Requests bigger than a block get a block of their
+// own size.
+static void* region_next_block(region_t* region, size_t size) {
+    region_block_t* block = region->current->next;
+    while (block && block->size < size) {
+        block = block->next;
+    }
+    
+    if (!block) {
+        size_t want = size > region->block_size ? size : region->block_size;
+        block = mymalloc(sizeof(region_block_t) + want, region->file, region->line);
+        if (!block) {
+            return NULL;
+        }
+        block->size = want;
+        block->next = region->current->next;
+        region->current->next = block;
+    }
+    
+    region->current = block;
+    region->top = (char*)(block + 1);
+    region->end = region->top + block->size;
+    return region->top;
+}
+
+void* region_alloc(region_t* region, size_t size) {
+    if (size == 0 || size > MAX_REQUEST) {
+        return NULL;
+    }
+    
+    size = (size + 7) & ~(size_t)7;
+    if ((size_t)(region->end - region->top) < size) {
+        if (!region_next_block(region, size)) {
+            return NULL;
+        }
+    }
+    
+    void* ptr = region->top;
+    region->top += size;
+    region->objects++;
+    region->bytes += size;
+    return ptr;
+}
+
+void region_reset(region_t* region) {
+    region->current = &region->head;
+    region->top = NULL;
+    region->end = NULL;
+    region->objects = 0;
+    region->bytes = 0;
+}
+
+void region_destroy(region_t* region) {
+    if (!region) {
+        return;
+    }
+    
+    LOCK();
+    if (region->prev) {
+        region->prev->next = region->next;
+    } else {
+        regions = region->next;
+    }
+    if (region->next) {
+        region->next->prev = region->prev;
+    }
+    UNLOCK();
+    
+    region_block_t* block = region->head.next;
+    while (block) {
+        region_block_t* next = block->next;
+        myfree(block, region->file, region->line);
+        block = next;
+    }
+    myfree(region, region->file, region->line);
+}
+
+// Handle blocks are always chunks, never slab objects, so that they can
+// be moved. They are not traced or profiled, since a trace cannot follow
+// a block that moves.
+handle_t* myhmalloc(size_t size, char* file, int line) {
+    count_call(&malloc_calls);
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    // room for the back pointer, and for a free chunk's links and footer
+    // once the block is freed
+    size_t payload = round_payload(size + sizeof(handle_t*));
+    if (payload < MIN_CHUNK_SIZE - HEADER_SIZE) {
+        payload = MIN_CHUNK_SIZE - HEADER_SIZE;
+    }
+    
+    handle_t* h = NULL;
+    if (size <= MAX_REQUEST) {
+        LOCK();
+        if (!initialized) {
+            init_heap();
+        }
+        h = block_alloc(sizeof(handle_t));
+        void* ptr = h ? heap_alloc(payload) : NULL;
+        if (ptr) {
+            h->chunk = (chunk_t*)((char*)ptr - HEADER_SIZE);
+            h->locks = 0;
+            h->chunk->size_and_flag |= HANDLE_BIT;
+            *(handle_t**)ptr = h;
+        } else if (h) {
+            arena_t* arena = find_arena(h);
+            block_free(h, arena, find_slab(arena, h));
+            h = NULL;
+        }
+        UNLOCK();
+    }
+    
+    if (!h) {
+        fprintf(stderr, "hmalloc: Unable to allocate %zu bytes (%s:%d)\n", 
+                size, file, line);
+        count_failure();
+    }
+    return h;
+}
+
+void* hlock(handle_t* h) {
+    LOCK();
+    h->locks++;
+    void* ptr = (char*)h->chunk + HEADER_SIZE + sizeof(handle_t*);
+    UNLOCK();
+    return ptr;
+}
+
+void hunlock(handle_t* h) {
+    LOCK();
+    if (h->locks > 0) {
+        h->locks--;
+    }
+    UNLOCK();
+}
+
+void myhfree(handle_t* h, char* file, int line) {
+    if (h == NULL) {
+        return;
+    }
+    count_call(&free_calls);
+    
+    arena_t* arena;
+    slab_t* slab;
+    
+    // a handle is only good while its block still points back at it
+    LOCK();
+    if (checked_block(h, &arena, &slab) == 0 ||
+        checked_block((char*)h->chunk + HEADER_SIZE, &arena, &slab) == 0 ||
+        *(handle_t**)((char*)h->chunk + HEADER_SIZE) != h) {
+        UNLOCK();
+        fprintf(stderr, "hfree: Inappropriate handle (%s:%d)\n", file, line);
+        exit(2);
+    }
+    
+    h->chunk->size_and_flag &= ~(size_t)HANDLE_BIT;
+    block_free((char*)h->chunk + HEADER_SIZE, arena, NULL);
+    arena = find_arena(h);
+    block_free(h, arena, find_slab(arena, h));
+    UNLOCK();
+}
+
+// Slide every unlocked handle block down over the free chunk in front
+// of it, so the free space in each arena gathers in front of the blocks
+// that cannot move and at its end. Blocks stay in their own arena.
+size_t mymalloc_compact(void) {
+    size_t moved = 0;
+    
+    LOCK();
+    if (initialized && !USE_BUDDY) {
+        // chunks on a quick list count as allocated and would stay put
+        quick_flush_all();
+        for (arena_t* a = arenas; a; a = a->next) {
+            moved += compact_arena(a);
+        }
+        rover = NULL;
+    }
+    UNLOCK();
+    
+    return moved;
+}
+
+// Compact one arena, returns the bytes moved. The free chunk before a
+// moved block is always preceded by an allocated one, since free chunks
+// are coalesced. Called with the lock held and the quick lists empty.
+static size_t compact_arena(arena_t* arena) {
+    size_t moved = 0;
+    chunk_t* hole = NULL;  // free chunk right before chunk
+    chunk_t* chunk = (chunk_t*)arena->bytes;
+    
+    while (chunk_size(chunk) > 0) {
+        size_t flags = chunk->size_and_flag;
+        handle_t* h = (flags & ALLOC_BIT) && (flags & HANDLE_BIT) ?
+            *(handle_t**)((char*)chunk + HEADER_SIZE) : NULL;
+        
+        if (!(flags & ALLOC_BIT)) {
+            hole = chunk;
+        } else if (hole && h && h->locks == 0) {
+            size_t size = chunk_size(chunk);
+            size_t gap = chunk_size(hole);
+            
+            remove_free(hole);
+            set_chunk_used(arena, chunk, 0);
+            memmove((char*)hole + HEADER_SIZE, (char*)chunk + HEADER_SIZE, size);
+            hole->size_and_flag = size | ALLOC_BIT | HANDLE_BIT | (hole->size_and_flag & PREV_FREE_BIT);
+            set_chunk_used(arena, hole, 1);
+            h->chunk = hole;
+            moved += size;
+            
+            // the gap now sits after the block, and may merge with the
+            // chunk after it
+            chunk_t* rest = next_chunk(hole);
+            rest->size_and_flag = gap;
+            hole = merge_neighbours(rest);
+            insert_free(hole);
+            chunk = next_chunk(hole);
+            continue;
+        } else {
+            hole = NULL;
+        }
+        
+        chunk = next_chunk(chunk);
+    }
+    
+    return moved;
+}
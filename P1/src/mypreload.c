@@ -0,0 +1,175 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <string.h>
+#include "mymalloc.h"
+
+// Built into libmymalloc.so, this file replaces the C library's malloc
+// family, so an unmodified program runs on mymalloc with
+//
+//     LD_PRELOAD=./libmymalloc.so program
+//
+// The mymalloc.h macros would rename the functions defined here.
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#undef aligned_alloc
+
+#define BOOTSTRAP_SIZE 65536
+
+// Every call is charged to this site in traces and profiles
+static char site[] = "libmymalloc.so";
+
+// A call that comes back into malloc while this thread is already inside
+// mymalloc, for example from atexit() or the pthread functions the first
+// call sets up, would take the heap lock twice. Those few blocks come
+// from a static buffer instead and are never freed. Each wrapper puts
+// busy back as it found it, so a nested call cannot clear it under the
+// call it came from.
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+static __thread int busy;
+
+static void* bootstrap_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    size_t offset = __atomic_fetch_add(&bootstrap_used, size, __ATOMIC_RELAXED);
+    if (size > BOOTSTRAP_SIZE || offset > BOOTSTRAP_SIZE - size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return bootstrap + offset;
+}
+
+static int from_bootstrap(void* ptr) {
+    return (char*)ptr >= bootstrap && (char*)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+// mymalloc gives NULL for 0 bytes, the C library a block that can be
+// freed. Programs take NULL for out of memory, so ask for 1 byte.
+void* malloc(size_t size) {
+    if (busy) {
+        return bootstrap_alloc(size);
+    }
+
+    int was_busy = busy;
+    busy = 1;
+    void* ptr = mymalloc(size ? size : 1, site, 0);
+    busy = was_busy;
+
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void free(void* ptr) {
+    // a free from inside mymalloc can only be of a bootstrap block
+    if (ptr == NULL || from_bootstrap(ptr) || busy) {
+        return;
+    }
+
+    int was_busy = busy;
+    busy = 1;
+    myfree(ptr, site, 0);
+    busy = was_busy;
+}
+
+void* calloc(size_t count, size_t size) {
+    if (busy) {
+        // static memory that was never handed out is still zero
+        if (size && count > BOOTSTRAP_SIZE / size) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        return bootstrap_alloc(count * size);
+    }
+
+    if (count == 0 || size == 0) {
+        count = 1;
+        size = 1;
+    }
+
+    int was_busy = busy;
+    busy = 1;
+    void* ptr = mycalloc(count, size, site, 0);
+    busy = was_busy;
+
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+
+    // a bootstrap block does not know its size, copy what the buffer
+    // holds after it
+    if (from_bootstrap(ptr)) {
+        void* new_ptr = malloc(size);
+        if (new_ptr) {
+            size_t left = bootstrap + BOOTSTRAP_SIZE - (char*)ptr;
+            memcpy(new_ptr, ptr, size < left ? size : left);
+        }
+        return new_ptr;
+    }
+
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    int was_busy = busy;
+    busy = 1;
+    void* new_ptr = myrealloc(ptr, size, site, 0);
+    busy = was_busy;
+
+    if (!new_ptr) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+static void* aligned(size_t alignment, size_t size) {
+    if (busy) {
+        return alignment <= 16 ? bootstrap_alloc(size) : NULL;
+    }
+
+    int was_busy = busy;
+    busy = 1;
+    void* ptr = myaligned_alloc(alignment, size ? size : 1, site, 0);
+    busy = was_busy;
+    return ptr;
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    void* ptr = aligned(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* ptr = aligned(alignment, size);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
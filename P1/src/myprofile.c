@@ -0,0 +1,308 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef THREADSAFE
+#include <pthread.h>
+#endif
+#include "myprofile.h"
+
+#define MAX_SITES 4096    // slots in the site table, a power of two
+#define OTHER_SITE MAX_SITES  // extra slot shared by sites that do not fit
+#define MIN_BLOCKS 4096   // starting size of the pointer table
+#define DEFAULT_TOP 10
+
+// One file and line. The file is compared by address, the macros pass
+// the same __FILE__ string for every call from one source file.
+typedef struct {
+    const char* file;
+    int line;
+    uint64_t calls;
+    uint64_t bytes;       // asked for, over the whole run
+    uint64_t live_bytes;
+    uint64_t peak_bytes;  // most live_bytes at once
+    uint64_t live_blocks;
+    uint64_t ns;
+} site_t;
+
+// pointer -> allocating site, open addressing with linear probing
+typedef struct {
+    void* ptr;
+    uint32_t site;
+    size_t size;
+} block_slot_t;
+
+// 0 until the environment has been read, -1 when profiling is off,
+// otherwise the number of sites to print
+static int top_sites = 0;
+
+// Like the trace, everything lives in mmap'd memory so the profile
+// never allocates from the heap it is watching
+static site_t* sites = NULL;
+static size_t site_count = 0;
+
+static block_slot_t* blocks = NULL;
+static size_t block_capacity = 0;
+static size_t block_count = 0;
+
+#ifdef THREADSAFE
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void* map_zeroed(size_t length) {
+    void* p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void profile_setup(void) {
+    char* env = getenv("MYMALLOC_PROFILE");
+    if (!env || !*env) {
+        top_sites = -1;
+        return;
+    }
+
+    sites = map_zeroed((MAX_SITES + 1) * sizeof(site_t));
+    if (!sites) {
+        top_sites = -1;
+        return;
+    }
+
+    int n = atoi(env);
+    top_sites = n > 0 ? n : DEFAULT_TOP;
+}
+
+int profile_enabled(void) {
+#ifdef THREADSAFE
+    pthread_once(&profile_once, profile_setup);
+#else
+    if (top_sites == 0) {
+        profile_setup();
+    }
+#endif
+    return top_sites > 0;
+}
+
+uint64_t profile_clock(void) {
+    if (top_sites <= 0) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t hash_site(const char* file, int line) {
+    return (((uintptr_t)file >> 3) ^ ((uint64_t)line << 20)) * 0x9E3779B97F4A7C15ULL >> 32;
+}
+
+// Find or add a site. When the table is nearly full new sites all share
+// one extra slot, which is printed as "(other)".
+static site_t* find_site(const char* file, int line) {
+    size_t i = hash_site(file, line) & (MAX_SITES - 1);
+    while (sites[i].file) {
+        if (sites[i].file == file && sites[i].line == line) {
+            return &sites[i];
+        }
+        i = (i + 1) & (MAX_SITES - 1);
+    }
+
+    if (4 * (site_count + 1) > 3 * MAX_SITES) {
+        site_t* other = &sites[OTHER_SITE];
+        if (!other->file) {
+            other->file = "(other)";
+            site_count++;
+        }
+        return other;
+    }
+
+    sites[i].file = file;
+    sites[i].line = line;
+    site_count++;
+    return &sites[i];
+}
+
+static size_t hash_ptr(void* ptr) {
+    return ((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+static int grow_blocks(void) {
+    size_t old_capacity = block_capacity;
+    block_slot_t* old = blocks;
+
+    size_t capacity = old_capacity ? old_capacity * 2 : MIN_BLOCKS;
+    block_slot_t* table = map_zeroed(capacity * sizeof(block_slot_t));
+    if (!table) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].ptr) {
+            size_t j = hash_ptr(old[i].ptr) & (capacity - 1);
+            while (table[j].ptr) {
+                j = (j + 1) & (capacity - 1);
+            }
+            table[j] = old[i];
+        }
+    }
+    if (old) {
+        munmap(old, old_capacity * sizeof(block_slot_t));
+    }
+
+    blocks = table;
+    block_capacity = capacity;
+    return 1;
+}
+
+static void add_block(void* ptr, site_t* site, size_t size) {
+    if (2 * (block_count + 1) > block_capacity && !grow_blocks()) {
+        return;  // out of memory for the table, the block goes unwatched
+    }
+
+    size_t i = hash_ptr(ptr) & (block_capacity - 1);
+    while (blocks[i].ptr) {
+        i = (i + 1) & (block_capacity - 1);
+    }
+    blocks[i].ptr = ptr;
+    blocks[i].site = site - sites;
+    blocks[i].size = size;
+    block_count++;
+
+    site->live_bytes += size;
+    site->live_blocks++;
+    if (site->live_bytes > site->peak_bytes) {
+        site->peak_bytes = site->live_bytes;
+    }
+}
+
+// Forget a block and take it off the site that allocated it. Later slots
+// in the same run are shifted back so probing never stops at a hole.
+static void remove_block(void* ptr) {
+    if (block_capacity == 0) {
+        return;
+    }
+
+    size_t mask = block_capacity - 1;
+    size_t i = hash_ptr(ptr) & mask;
+    while (blocks[i].ptr != ptr) {
+        if (!blocks[i].ptr) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    site_t* site = &sites[blocks[i].site];
+    site->live_bytes -= blocks[i].size;
+    site->live_blocks--;
+
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; blocks[j].ptr; j = (j + 1) & mask) {
+        size_t home = hash_ptr(blocks[j].ptr) & mask;
+        // move j into the hole unless its home lies between the two
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            blocks[hole] = blocks[j];
+            hole = j;
+        }
+    }
+    blocks[hole].ptr = NULL;
+    block_count--;
+}
+
+void profile_alloc(void* ptr, size_t size, uint64_t ns, const char* file, int line) {
+    if (top_sites <= 0) {
+        return;
+    }
+
+    site_t* site = find_site(file, line);
+    site->calls++;
+    site->ns += ns;
+    if (ptr) {
+        site->bytes += size;
+        add_block(ptr, site, size);
+    }
+}
+
+void profile_free(void* ptr, uint64_t ns, const char* file, int line) {
+    if (top_sites <= 0) {
+        return;
+    }
+
+    site_t* site = find_site(file, line);
+    site->calls++;
+    site->ns += ns;
+    remove_block(ptr);
+}
+
+void profile_realloc(void* ptr, void* old_ptr, size_t size, uint64_t ns, const char* file, int line) {
+    if (top_sites <= 0) {
+        return;
+    }
+
+    site_t* site = find_site(file, line);
+    site->calls++;
+    site->ns += ns;
+
+    // a failed realloc leaves the old block where it was
+    if (old_ptr && (ptr || size == 0)) {
+        remove_block(old_ptr);
+    }
+    if (ptr) {
+        site->bytes += size;
+        add_block(ptr, site, size);
+    }
+}
+
+static int by_time(const void* a, const void* b) {
+    const site_t* x = *(const site_t* const*)a;
+    const site_t* y = *(const site_t* const*)b;
+    return x->ns < y->ns ? 1 : x->ns > y->ns ? -1 : 0;
+}
+
+static int by_live_bytes(const void* a, const void* b) {
+    const site_t* x = *(const site_t* const*)a;
+    const site_t* y = *(const site_t* const*)b;
+    return x->live_bytes < y->live_bytes ? 1 : x->live_bytes > y->live_bytes ? -1 : 0;
+}
+
+// Runs at exit from the leak check, without the lock, for the same
+// reason trace_close does
+void profile_report(void) {
+    if (top_sites <= 0 || site_count == 0) {
+        return;
+    }
+
+    site_t** order = map_zeroed(site_count * sizeof(site_t*));
+    if (!order) {
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i <= OTHER_SITE; i++) {
+        if (sites[i].file) {
+            order[n++] = &sites[i];
+        }
+    }
+
+    qsort(order, n, sizeof(site_t*), by_time);
+    size_t shown = n < (size_t)top_sites ? n : (size_t)top_sites;
+    fprintf(stderr, "mymalloc: top %zu of %zu call sites by time in the allocator:\n", shown, n);
+    fprintf(stderr, "  %-32s %10s %12s %12s %12s\n", "site", "calls", "bytes", "peak live", "time (us)");
+    for (size_t i = 0; i < shown; i++) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s:%d", order[i]->file, order[i]->line);
+        fprintf(stderr, "  %-32s %10llu %12llu %12llu %12.1f\n", name,
+                (unsigned long long)order[i]->calls, (unsigned long long)order[i]->bytes,
+                (unsigned long long)order[i]->peak_bytes, order[i]->ns / 1000.0);
+    }
+
+    qsort(order, n, sizeof(site_t*), by_live_bytes);
+    for (size_t i = 0; i < n && order[i]->live_blocks > 0; i++) {
+        if (i == 0) {
+            fprintf(stderr, "mymalloc: leaks by call site:\n");
+        }
+        fprintf(stderr, "  %s:%d: %llu bytes in %llu objects\n", order[i]->file, order[i]->line,
+                (unsigned long long)order[i]->live_bytes, (unsigned long long)order[i]->live_blocks);
+    }
+
+    munmap(order, site_count * sizeof(site_t*));
+}
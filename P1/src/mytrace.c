@@ -0,0 +1,297 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef THREADSAFE
+#include <pthread.h>
+#endif
+#include "mytrace.h"
+
+#define TRACE_BUFFER 2048  // records kept before a write()
+#define MAX_SITES 1024
+#define MIN_IDS 4096       // starting size of the pointer table
+
+// pointer -> number and the site that allocated it, open addressing
+// with linear probing
+typedef struct {
+    void* ptr;
+    uint32_t id;
+    uint32_t line;
+    uint16_t site;
+} id_slot_t;
+
+// -2 until the environment has been read, -1 when tracing is off
+static int trace_fd = -2;
+static uint64_t start_ns;
+
+// Everything here lives in mmap'd or static memory, never in the heap
+// being traced
+static trace_record_t buffer[TRACE_BUFFER];
+static int buffered = 0;
+
+static const char* sites[MAX_SITES];
+static int site_count = 0;
+
+static id_slot_t* ids = NULL;
+static size_t id_capacity = 0;
+static size_t id_count = 0;
+static uint32_t next_id = 1;
+
+#ifdef THREADSAFE
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_all(const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = write(trace_fd, p, length);
+        if (n <= 0) {
+            return;
+        }
+        p += n;
+        length -= n;
+    }
+}
+
+static void flush_buffer(void) {
+    write_all(buffer, buffered * sizeof(trace_record_t));
+    buffered = 0;
+}
+
+// Runs at exit without the lock, so a program that dies inside a traced
+// call (say, on a bad free) still gets its trace
+static void trace_close(void) {
+    flush_buffer();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+static size_t hash_ptr(void* ptr) {
+    return ((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+static void grow_ids(void) {
+    size_t old_capacity = id_capacity;
+    id_slot_t* old = ids;
+
+    id_capacity = old_capacity ? old_capacity * 2 : MIN_IDS;
+    ids = mmap(NULL, id_capacity * sizeof(id_slot_t), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ids == MAP_FAILED) {
+        // out of memory for the table, stop tracing rather than lie
+        ids = old;
+        id_capacity = old_capacity;
+        trace_close();
+        return;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].ptr) {
+            size_t j = hash_ptr(old[i].ptr) & (id_capacity - 1);
+            while (ids[j].ptr) {
+                j = (j + 1) & (id_capacity - 1);
+            }
+            ids[j] = old[i];
+        }
+    }
+    if (old) {
+        munmap(old, old_capacity * sizeof(id_slot_t));
+    }
+}
+
+static uint32_t add_id(void* ptr, int site, int line) {
+    if (2 * (id_count + 1) > id_capacity) {
+        grow_ids();
+        if (trace_fd < 0) {
+            return 0;
+        }
+    }
+
+    size_t i = hash_ptr(ptr) & (id_capacity - 1);
+    while (ids[i].ptr && ids[i].ptr != ptr) {
+        i = (i + 1) & (id_capacity - 1);
+    }
+    if (!ids[i].ptr) {
+        id_count++;
+    }
+    ids[i].ptr = ptr;
+    ids[i].id = next_id++;
+    ids[i].site = site;
+    ids[i].line = line;
+    return ids[i].id;
+}
+
+// Look up a pointer's number and forget it. Later slots in the same run
+// are shifted back so probing never stops at a hole.
+static uint32_t remove_id(void* ptr) {
+    if (id_capacity == 0) {
+        return 0;
+    }
+
+    size_t mask = id_capacity - 1;
+    size_t i = hash_ptr(ptr) & mask;
+    while (ids[i].ptr != ptr) {
+        if (!ids[i].ptr) {
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+
+    uint32_t id = ids[i].id;
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; ids[j].ptr; j = (j + 1) & mask) {
+        size_t home = hash_ptr(ids[j].ptr) & mask;
+        // move j into the hole unless its home lies between the two
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            ids[hole] = ids[j];
+            hole = j;
+        }
+    }
+    ids[hole].ptr = NULL;
+    id_count--;
+    return id;
+}
+
+static trace_record_t* next_record(void) {
+    if (buffered == TRACE_BUFFER) {
+        flush_buffer();
+    }
+    return &buffer[buffered++];
+}
+
+// Number a source file, writing a TRACE_SITE record the first time
+static int site_number(const char* file) {
+    for (int i = site_count - 1; i >= 0; i--) {
+        if (sites[i] == file || strcmp(sites[i], file) == 0) {
+            return i;
+        }
+    }
+    if (site_count == MAX_SITES) {
+        return MAX_SITES - 1;
+    }
+
+    size_t length = strlen(file);
+    trace_record_t* rec = next_record();
+    memset(rec, 0, sizeof(*rec));
+    rec->op = TRACE_SITE;
+    rec->site = site_count;
+    rec->line = length;
+    flush_buffer();
+    write_all(file, length);
+
+    sites[site_count] = file;
+    return site_count++;
+}
+
+static void trace_setup(void) {
+    char* path = getenv("MYMALLOC_TRACE");
+    if (!path || !*path) {
+        trace_fd = -1;
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        trace_fd = -1;
+        return;
+    }
+
+    trace_fd = fd;
+    start_ns = now_ns();
+    trace_header_t header = {TRACE_MAGIC, TRACE_VERSION};
+    write_all(&header, sizeof(header));
+    atexit(trace_close);
+}
+
+int trace_enabled(void) {
+#ifdef THREADSAFE
+    pthread_once(&trace_once, trace_setup);
+#else
+    if (trace_fd == -2) {
+        trace_setup();
+    }
+#endif
+    return trace_fd >= 0;
+}
+
+void trace_lock(void) {
+#ifdef THREADSAFE
+    pthread_mutex_lock(&trace_mutex);
+#endif
+}
+
+void trace_unlock(void) {
+#ifdef THREADSAFE
+    pthread_mutex_unlock(&trace_mutex);
+#endif
+}
+
+static void write_event(int op, int align_log2, void* ptr, void* old_ptr, size_t size,
+                        const char* file, int line) {
+    if (trace_fd < 0) {
+        return;
+    }
+
+    uint32_t old_id = 0;
+    if (op == TRACE_FREE || op == TRACE_REALLOC) {
+        // a failed realloc leaves the old block alive
+        if (old_ptr && (ptr || size == 0)) {
+            old_id = remove_id(old_ptr);
+            if (old_id == 0) {
+                return;  // not one of ours, the call is about to fail
+            }
+        } else if (old_ptr) {
+            return;
+        }
+    }
+
+    int site = site_number(file);
+    uint32_t id = ptr ? add_id(ptr, site, line) : 0;
+    if (trace_fd < 0) {
+        return;
+    }
+
+    trace_record_t* rec = next_record();
+    rec->op = op;
+    rec->align_log2 = align_log2;
+    rec->site = site;
+    rec->line = line;
+    rec->id = op == TRACE_FREE ? old_id : id;
+    rec->old_id = op == TRACE_FREE ? 0 : old_id;
+    rec->size = size;
+    rec->time_ns = now_ns() - start_ns;
+}
+
+void trace_event(int op, void* ptr, void* old_ptr, size_t size, const char* file, int line) {
+    write_event(op, 0, ptr, old_ptr, size, file, line);
+}
+
+void trace_aligned(void* ptr, size_t alignment, size_t size, const char* file, int line) {
+    write_event(TRACE_ALIGNED, alignment ? __builtin_ctzll(alignment) : 0, ptr, NULL, size, file, line);
+}
+
+const char* trace_site(void* ptr, int* site, int* line) {
+    if (trace_fd < 0 || id_capacity == 0) {
+        return NULL;
+    }
+
+    size_t mask = id_capacity - 1;
+    for (size_t i = hash_ptr(ptr) & mask; ids[i].ptr; i = (i + 1) & mask) {
+        if (ids[i].ptr == ptr) {
+            *site = ids[i].site;
+            *line = ids[i].line;
+            return sites[ids[i].site];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 10: regions\n");
+    
+    mymalloc_stats_t before, stats;
+    free(malloc(100));
+    mymalloc_stats(&before);
+    
+    // objects are handed out back to back, 8-byte aligned
+    printf("  Testing region_alloc...\n");
+    region_t* region = region_create(1024);
+    if (!region) {
+        printf("  ERROR: region_create failed\n");
+        return 1;
+    }
+    char* ptrs[100];
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = region_alloc(region, 1 + i % 30);
+        if (!ptrs[i] || (uintptr_t)ptrs[i] % 8 != 0) {
+            printf("  ERROR: region_alloc %d failed\n", i);
+            return 1;
+        }
+        memset(ptrs[i], i, 1 + i % 30);
+    }
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < 1 + i % 30; j++) {
+            if (ptrs[i][j] != i) {
+                printf("  ERROR: object %d was overwritten\n", i);
+                return 1;
+            }
+        }
+    }
+    if (region_alloc(region, 0) != NULL) {
+        printf("  ERROR: region_alloc(0) returned memory\n");
+        return 1;
+    }
+    
+    // bigger than a block gets a block of its own
+    printf("  Testing large objects...\n");
+    char* big = region_alloc(region, 5000);
+    char* after = region_alloc(region, 16);
+    if (!big || !after) {
+        printf("  ERROR: large region_alloc failed\n");
+        return 1;
+    }
+    memset(big, 0xab, 5000);
+    
+    // a reset starts again from the first block without freeing anything
+    printf("  Testing region_reset...\n");
+    mymalloc_stats(&stats);
+    size_t live = stats.live_objects;
+    size_t frees = stats.free_calls;
+    region_reset(region);
+    char* again = region_alloc(region, 8);
+    if (again != ptrs[0]) {
+        printf("  ERROR: reset did not start from the first block\n");
+        return 1;
+    }
+    for (int i = 0; i < 200; i++) {
+        region_alloc(region, 24);
+    }
+    mymalloc_stats(&stats);
+    if (stats.live_objects != live || stats.free_calls != frees) {
+        printf("  ERROR: reset should reuse the blocks it kept\n");
+        return 1;
+    }
+    
+    // everything comes back on destroy
+    printf("  Testing region_destroy...\n");
+    region_destroy(region);
+    region_destroy(NULL);
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects) {
+        printf("  ERROR: %zu blocks left after destroy\n", 
+               stats.live_objects - before.live_objects);
+        return 1;
+    }
+    
+    // several regions at once, with the default block size
+    printf("  Testing several regions...\n");
+    region_t* regions[5];
+    for (int i = 0; i < 5; i++) {
+        regions[i] = region_create(0);
+        for (int j = 0; j < 100; j++) {
+            memset(region_alloc(regions[i], 64), i, 64);
+        }
+    }
+    for (int i = 4; i >= 0; i -= 2) {
+        region_destroy(regions[i]);
+    }
+    region_destroy(regions[1]);
+    region_destroy(regions[3]);
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects) {
+        printf("  ERROR: regions left blocks behind\n");
+        return 1;
+    }
+    
+    printf("Test 10 passed!\n");
+    return 0;
+}
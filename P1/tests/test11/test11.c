@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include "mymalloc.h"
+
+#define OVERFLOW 40
+
+int main() {
+    printf("Test 11: deferred coalescing\n");
+    
+    mymalloc_stats_t before, stats;
+    
+    free(malloc(100));
+    if (mymalloc_set_quick_lists(1) != 0) {
+        printf("  ERROR: quick lists should start off\n");
+        return 1;
+    }
+    mymalloc_stats(&before);
+    
+    // the last chunk freed is the first one handed out again
+    printf("  Testing reuse...\n");
+    char* a = malloc(100);
+    char* b = malloc(100);
+    free(a);
+    free(b);
+    
+    mymalloc_stats(&stats);
+    if (stats.merges != before.merges || stats.free_chunks != before.free_chunks + 2 ||
+        stats.live_objects != before.live_objects) {
+        printf("  ERROR: freed chunks should wait unmerged\n");
+        return 1;
+    }
+    if (malloc(100) != b || malloc(100) != a) {
+        printf("  ERROR: freed chunks were not reused\n");
+        return 1;
+    }
+    memset(a, 1, 100);
+    memset(b, 2, 100);
+    free(a);
+    free(b);
+    
+    // a list that fills up is merged
+    printf("  Testing overflow...\n");
+    void* ptrs[OVERFLOW];
+    for (int i = 0; i < OVERFLOW; i++) {
+        ptrs[i] = malloc(72);
+        if (!ptrs[i]) {
+            printf("  ERROR: malloc failed\n");
+            return 1;
+        }
+    }
+    mymalloc_stats(&before);
+    for (int i = 0; i < OVERFLOW; i++) {
+        free(ptrs[i]);
+    }
+    mymalloc_stats(&stats);
+    if (stats.merges <= before.merges) {
+        printf("  ERROR: an overflowing list was not merged\n");
+        return 1;
+    }
+    
+    // a request that only fits once the lists are merged
+    printf("  Testing merge on a miss...\n");
+    mymalloc_set_quick_lists(0);
+    mymalloc_set_quick_lists(1);
+    mymalloc_stats(&before);
+    for (int i = 0; i < 6; i++) {
+        ptrs[i] = malloc(400);
+    }
+    for (int i = 0; i < 6; i++) {
+        free(ptrs[i]);
+    }
+    char* big = malloc(2000);
+    mymalloc_stats(&stats);
+    if (!big || stats.heap_bytes != before.heap_bytes) {
+        printf("  ERROR: expected the quick lists to be merged instead of a new arena\n");
+        return 1;
+    }
+    free(big);
+    
+    // turning them off merges everything that is left
+    printf("  Testing turning them off...\n");
+    a = malloc(300);
+    free(a);
+    mymalloc_set_quick_lists(0);
+    mymalloc_stats(&stats);
+    if (stats.free_chunks != before.free_chunks || stats.live_objects != before.live_objects) {
+        printf("  ERROR: expected the heap to be back as it was\n");
+        return 1;
+    }
+    
+    printf("Test 11 passed!\n");
+    return 0;
+}
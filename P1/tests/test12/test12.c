@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mymalloc.h"
+
+#define HANDLES 24
+#define SIZE 100
+
+static int check(handle_t* h, int value) {
+    unsigned char* p = hlock(h);
+    int ok = 1;
+    for (int j = 0; j < SIZE; j++) {
+        if (p[j] != value) {
+            ok = 0;
+        }
+    }
+    hunlock(h);
+    return ok;
+}
+
+int main() {
+    printf("Test 12: handles and compaction\n");
+    
+    // the holes only matter in an arena they fill, so use a one-page
+    // arena rather than the default; read at the first allocation
+    setenv("MYMALLOC_ARENA_SIZE", "4096", 1);
+    
+    mymalloc_stats_t before, stats;
+    handle_t* h[HANDLES];
+    
+    // every other block freed leaves the arena full of small holes, with
+    // the free space at its end smaller than them put together
+    printf("  Testing handle blocks...\n");
+    for (int i = 0; i < HANDLES; i++) {
+        h[i] = hmalloc(SIZE);
+        if (!h[i]) {
+            printf("  ERROR: hmalloc failed\n");
+            return 1;
+        }
+        memset(hlock(h[i]), i, SIZE);
+        hunlock(h[i]);
+    }
+    for (int i = 0; i < HANDLES; i += 2) {
+        hfree(h[i]);
+        h[i] = NULL;
+    }
+    
+    // a locked block must not move
+    char* pinned = hlock(h[HANDLES - 1]);
+    
+    printf("  Testing compaction...\n");
+    mymalloc_stats(&before);
+    size_t moved = mymalloc_compact();
+    mymalloc_stats(&stats);
+    
+    if (moved == 0) {
+        printf("  ERROR: nothing was moved\n");
+        return 1;
+    }
+    if (stats.largest_free <= before.largest_free || stats.largest_free < HANDLES / 2 * (SIZE + 8)) {
+        printf("  ERROR: largest free chunk only grew from %zu to %zu\n",
+               before.largest_free, stats.largest_free);
+        return 1;
+    }
+    if (stats.live_objects != before.live_objects || stats.heap_bytes != before.heap_bytes) {
+        printf("  ERROR: compaction changed the live objects or the heap size\n");
+        return 1;
+    }
+    if (hlock(h[HANDLES - 1]) != pinned) {
+        printf("  ERROR: a locked block moved\n");
+        return 1;
+    }
+    hunlock(h[HANDLES - 1]);
+    hunlock(h[HANDLES - 1]);
+    
+    for (int i = 1; i < HANDLES; i += 2) {
+        if (!check(h[i], i)) {
+            printf("  ERROR: block %d lost its data\n", i);
+            return 1;
+        }
+    }
+    
+    // what was scattered is now one chunk an ordinary malloc can use
+    printf("  Testing a large request after compaction...\n");
+    char* big = malloc(before.largest_free + SIZE);
+    mymalloc_stats(&stats);
+    if (!big || stats.heap_bytes != before.heap_bytes) {
+        printf("  ERROR: expected the large request to fit without a new arena\n");
+        return 1;
+    }
+    free(big);
+    
+    for (int i = 1; i < HANDLES; i += 2) {
+        hfree(h[i]);
+    }
+    hfree(NULL);
+    
+    printf("Test 12 passed!\n");
+    return 0;
+}
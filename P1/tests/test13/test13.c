@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include "mymalloc.h"
+#include "mysnapshot.h"
+
+// kept for heapmap to read, before and after the second round
+#define PATH_A "test13a.snap"
+#define PATH_B "test13b.snap"
+
+// Read a snapshot back and add up its chunks by state
+static int read_snapshot(const char* path, size_t* arenas, size_t* count, size_t* bytes) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    
+    snapshot_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        fclose(fp);
+        return -1;
+    }
+    
+    memset(count, 0, 5 * sizeof(size_t));
+    memset(bytes, 0, 5 * sizeof(size_t));
+    *arenas = 0;
+    
+    snapshot_record_t rec;
+    size_t next_offset = 0;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.type == SNAPSHOT_ARENA) {
+            (*arenas)++;
+            next_offset = 0;
+        } else if (rec.type == SNAPSHOT_CHUNK) {
+            // chunks come in address order with nothing between them
+            if (rec.offset != next_offset || rec.state > SNAPSHOT_QUICK) {
+                fclose(fp);
+                return -1;
+            }
+            next_offset = rec.offset + 8 + rec.size;
+            count[rec.state]++;
+            bytes[rec.state] += rec.size;
+        } else {
+            fseek(fp, rec.line, SEEK_CUR);
+        }
+    }
+    
+    fclose(fp);
+    return 0;
+}
+
+int main() {
+    printf("Test 13: heap snapshot\n");
+    
+    mymalloc_stats_t stats;
+    size_t arenas, count[5], bytes[5];
+    
+    printf("  Testing a snapshot against the stats...\n");
+    void* keep[20];
+    for (int i = 0; i < 20; i++) {
+        keep[i] = malloc(100 + 50 * i);
+    }
+    for (int i = 0; i < 20; i += 3) {
+        free(keep[i]);
+        keep[i] = NULL;
+    }
+    char* small = malloc(10);
+    
+    if (mymalloc_snapshot(PATH_A) != 0 || read_snapshot(PATH_A, &arenas, count, bytes) != 0) {
+        printf("  ERROR: could not write or read back the snapshot\n");
+        return 1;
+    }
+    mymalloc_stats(&stats);
+    
+    if (count[SNAPSHOT_FREE] != stats.free_chunks || bytes[SNAPSHOT_FREE] != stats.free_bytes) {
+        printf("  ERROR: snapshot has %zu free chunks, stats say %zu\n",
+               count[SNAPSHOT_FREE], stats.free_chunks);
+        return 1;
+    }
+    // one slab holds the small object
+    if (count[SNAPSHOT_USED] + 1 != stats.live_objects || count[SNAPSHOT_SLAB] != 1) {
+        printf("  ERROR: snapshot has %zu blocks, stats say %zu\n",
+               count[SNAPSHOT_USED] + count[SNAPSHOT_SLAB], stats.live_objects);
+        return 1;
+    }
+    
+    // freed chunks on a quick list show up as such
+    printf("  Testing quick list chunks...\n");
+    mymalloc_set_quick_lists(1);
+    free(keep[1]);
+    keep[1] = NULL;
+    for (int i = 0; i < 20; i += 3) {
+        keep[i] = malloc(200);
+    }
+    if (mymalloc_snapshot(PATH_B) != 0 || read_snapshot(PATH_B, &arenas, count, bytes) != 0 ||
+        count[SNAPSHOT_QUICK] != 1) {
+        printf("  ERROR: expected one quick list chunk\n");
+        return 1;
+    }
+    mymalloc_set_quick_lists(0);
+    
+    printf("  Testing a path that cannot be written...\n");
+    if (mymalloc_snapshot("no/such/directory/" PATH_A) != -1) {
+        printf("  ERROR: expected -1\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < 20; i++) {
+        free(keep[i]);
+    }
+    free(small);
+    
+    printf("  All snapshot tests passed\n");
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 3d: Error detection - interior pointer\n");
+    
+    printf("  Allocating memory...\n");
+    char* ptr = malloc(256);
+    
+    if (ptr == NULL) {
+        printf("  ERROR: malloc failed\n");
+        return 1;
+    }
+    
+    // make the bytes in front of ptr + 128 look like an allocated header
+    size_t fake_header = 64 | 1;
+    memcpy(ptr + 120, &fake_header, sizeof(fake_header));
+    
+    printf("  Should print error and exit:\n");
+    printf("  Calling free(ptr + 128)...\n");
+    fflush(stdout);
+    
+    free(ptr + 128); // should error and exit
+    
+    printf("  ERROR: Should have exited\n");
+    return 1;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 3e: Error detection - double free in one batch\n");
+    
+    printf("  Allocating memory...\n");
+    void* ptrs[3];
+    ptrs[0] = malloc(100);
+    ptrs[1] = malloc(100);
+    ptrs[2] = ptrs[0];
+    
+    if (ptrs[0] == NULL || ptrs[1] == NULL) {
+        printf("  ERROR: malloc failed\n");
+        return 1;
+    }
+    
+    printf("  Freeing a batch with the first block twice - should error and exit:\n");
+    fflush(stdout);
+    
+    free_batch(ptrs, 3); // should error and exit
+    
+    printf("  ERROR: Should have exited\n");
+    return 1;
+}
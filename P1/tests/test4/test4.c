@@ -7,16 +7,20 @@
 int main() {
     printf("Test 4: Edge cases\n");
     
-    // very large allocation
+    // very large allocation gets its own arena
     printf("  Testing huge allocation...\n");
-    void* huge = malloc(10000);
+    char* huge = malloc(10000);
     if (huge == NULL) {
-        printf("  Large alloc failed as expected\n");
-    } else {
-        printf("  ERROR: Large alloc should have failed\n");
-        free(huge);
+        printf("  ERROR: Large alloc failed\n");
+        return 1;
+    }
+    memset(huge, 0x5A, 10000);
+    if ((unsigned char)huge[0] != 0x5A || (unsigned char)huge[9999] != 0x5A) {
+        printf("  ERROR: Large alloc corrupted\n");
         return 1;
     }
+    printf("  Large alloc worked\n");
+    free(huge);
     
     // exact size allocation
     printf("  Testing exact size alloc...\n");
@@ -16,8 +16,18 @@ int main() {
         return 1;
     }
     
+    // a region is reported as one leak, not once per block or object
+    region_t* region = region_create(0);
+    for (int i = 0; i < 10; i++) {
+        if (!region_alloc(region, 40)) {
+            printf("ERROR: region_alloc failed\n");
+            return 1;
+        }
+    }
+    
     printf("Allocated 3 objects (100, 200, 50 bytes).\n");
-    printf("Expected leak: 350 bytes in 3 objects\n");
+    printf("Allocated 10 objects of 40 bytes from a region.\n");
+    printf("Expected leak: the region with 400 bytes in 10 objects, then 350 bytes in 3 objects\n");
     printf("Ending - leak detector should run...\n");
     
     // don't free - let leak detector catch them
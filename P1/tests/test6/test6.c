@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 6: realloc and calloc\n");
+    
+    // grow into a free neighbour
+    printf("  Testing in-place growth...\n");
+    char* ptr1 = malloc(100);
+    char* ptr2 = malloc(100);
+    char* ptr3 = malloc(100);
+    
+    if (!ptr1 || !ptr2 || !ptr3) {
+        printf("  ERROR: Initial allocs failed\n");
+        return 1;
+    }
+    
+    memset(ptr1, 0xAA, 100);
+    free(ptr2);
+    
+    char* grown = realloc(ptr1, 200);
+    if (grown != ptr1) {
+        printf("  ERROR: realloc moved a block that could grow in place\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < 100; i++) {
+        if ((unsigned char)grown[i] != 0xAA) {
+            printf("  ERROR: grown[%d] corrupted\n", i);
+            return 1;
+        }
+    }
+    
+    // shrink by splitting, the tail is reusable afterwards
+    printf("  Testing in-place shrink...\n");
+    char* shrunk = realloc(grown, 80);
+    if (shrunk != grown) {
+        printf("  ERROR: realloc moved a block that was shrinking\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < 80; i++) {
+        if ((unsigned char)shrunk[i] != 0xAA) {
+            printf("  ERROR: shrunk[%d] corrupted\n", i);
+            return 1;
+        }
+    }
+    
+    // blocked by ptr3, so it has to move
+    printf("  Testing move when growth is blocked...\n");
+    char* moved = realloc(shrunk, 400);
+    if (moved == NULL) {
+        printf("  ERROR: realloc to 400 failed\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < 80; i++) {
+        if ((unsigned char)moved[i] != 0xAA) {
+            printf("  ERROR: moved[%d] corrupted\n", i);
+            return 1;
+        }
+    }
+    
+    free(moved);
+    free(ptr3);
+    
+    // small objects stay put within their size class
+    printf("  Testing small object realloc...\n");
+    char* small = malloc(20);
+    strcpy(small, "size class");
+    char* same = realloc(small, 30);
+    if (same != small) {
+        printf("  ERROR: realloc inside the size class moved\n");
+        return 1;
+    }
+    char* bigger = realloc(same, 300);
+    if (bigger == NULL || strcmp(bigger, "size class") != 0) {
+        printf("  ERROR: realloc out of the size class lost data\n");
+        return 1;
+    }
+    free(bigger);
+    
+    // realloc(NULL, n) and realloc(p, 0)
+    char* fresh = realloc(NULL, 50);
+    if (fresh == NULL) {
+        printf("  ERROR: realloc(NULL, 50) failed\n");
+        return 1;
+    }
+    if (realloc(fresh, 0) != NULL) {
+        printf("  ERROR: realloc(p, 0) should free and return NULL\n");
+        return 1;
+    }
+    printf("  realloc works\n");
+    
+    // calloc must clear recycled memory
+    printf("  Testing calloc...\n");
+    int sizes[] = {24, 200, 1000};
+    for (int s = 0; s < 3; s++) {
+        char* dirty = malloc(sizes[s]);
+        memset(dirty, 0xFF, sizes[s]);
+        free(dirty);
+        
+        char* clean = calloc(1, sizes[s]);
+        if (clean == NULL) {
+            printf("  ERROR: calloc(1, %d) failed\n", sizes[s]);
+            return 1;
+        }
+        for (int i = 0; i < sizes[s]; i++) {
+            if (clean[i] != 0) {
+                printf("  ERROR: calloc(1, %d) byte %d not zero\n", sizes[s], i);
+                return 1;
+            }
+        }
+        free(clean);
+    }
+    
+    // and fresh memory from a new arena
+    int* table = calloc(2000, sizeof(int));
+    if (table == NULL) {
+        printf("  ERROR: calloc(2000, 4) failed\n");
+        return 1;
+    }
+    for (int i = 0; i < 2000; i++) {
+        if (table[i] != 0) {
+            printf("  ERROR: table[%d] not zero\n", i);
+            return 1;
+        }
+    }
+    free(table);
+    printf("  calloc works\n");
+    
+    printf("Test 6 passed!\n");
+    return 0;
+}
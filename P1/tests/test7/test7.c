@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 7: heap statistics\n");
+    
+    mymalloc_stats_t before, stats;
+    
+    // turn on the SIGUSR1 dump before the first call sets the heap up
+    setenv("MYMALLOC_STATS", "1", 1);
+    free(malloc(100));
+    mymalloc_stats(&before);
+    
+    // live bytes and objects
+    printf("  Testing live counts...\n");
+    char* ptrs[3];
+    for (int i = 0; i < 3; i++) {
+        ptrs[i] = malloc(200);
+        if (!ptrs[i]) {
+            printf("  ERROR: malloc %d failed\n", i);
+            return 1;
+        }
+    }
+    
+#ifdef BUDDY
+    // buddy blocks are rounded up to a power of two, header included
+    size_t expected = 3 * (256 - 8);
+#else
+    size_t expected = 600;
+#endif
+    
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects + 3 ||
+        stats.live_bytes != before.live_bytes + expected) {
+        printf("  ERROR: expected 3 more live objects and %zu more bytes, got %zu and %zu\n",
+               expected, stats.live_objects - before.live_objects, 
+               stats.live_bytes - before.live_bytes);
+        return 1;
+    }
+    if (stats.malloc_calls != before.malloc_calls + 3) {
+        printf("  ERROR: malloc_calls is %zu\n", stats.malloc_calls);
+        return 1;
+    }
+    
+    // a hole between two live blocks is free but does not add to the
+    // largest free chunk
+    printf("  Testing fragmentation...\n");
+    free(ptrs[1]);
+    mymalloc_stats(&stats);
+    if (stats.free_chunks < 2 || stats.fragmentation <= 0) {
+        printf("  ERROR: expected a hole, got %zu free chunks and %.3f fragmentation\n",
+               stats.free_chunks, stats.fragmentation);
+        return 1;
+    }
+    if (stats.largest_free > stats.free_bytes) {
+        printf("  ERROR: largest free chunk bigger than all free bytes\n");
+        return 1;
+    }
+    
+    // freeing the neighbours merges them into the hole. Buddy blocks
+    // only merge with their buddy, which is one of the two.
+#ifdef BUDDY
+    size_t expected_merges = 1;
+#else
+    size_t expected_merges = 2;
+#endif
+    printf("  Testing merge count...\n");
+    size_t merges = stats.merges;
+    free(ptrs[0]);
+    free(ptrs[2]);
+    mymalloc_stats(&stats);
+    if (stats.merges < merges + expected_merges) {
+        printf("  ERROR: expected at least %zu merges, got %zu\n", 
+               expected_merges, stats.merges - merges);
+        return 1;
+    }
+    if (stats.live_objects != before.live_objects || stats.free_calls != before.free_calls + 3) {
+        printf("  ERROR: counts did not go back after freeing\n");
+        return 1;
+    }
+    if (stats.avg_scanned <= 0) {
+        printf("  ERROR: no chunks scanned\n");
+        return 1;
+    }
+    
+    // the stats are printed by the next call, not in the handler
+    printf("  Testing signal...\n");
+    raise(SIGUSR1);
+    free(malloc(10));
+    
+    printf("Test 7 passed!\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "mymalloc.h"
+
+int main() {
+    printf("Test 8: aligned_alloc\n");
+    
+    // every power of two from 16 to a page, each block written end to end
+    printf("  Testing alignments...\n");
+    char* ptrs[9];
+    int count = 0;
+    for (size_t align = 16; align <= 4096; align *= 2) {
+        ptrs[count] = aligned_alloc(align, 100);
+        if (!ptrs[count]) {
+            printf("  ERROR: aligned_alloc(%zu, 100) failed\n", align);
+            return 1;
+        }
+        if ((uintptr_t)ptrs[count] % align != 0) {
+            printf("  ERROR: %p is not aligned to %zu\n", (void*)ptrs[count], align);
+            return 1;
+        }
+        memset(ptrs[count], count, 100);
+        count++;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 100; j++) {
+            if (ptrs[i][j] != i) {
+                printf("  ERROR: block %d was overwritten\n", i);
+                return 1;
+            }
+        }
+        free(ptrs[i]);
+    }
+    
+    // small alignments are plain mallocs
+    printf("  Testing small alignments...\n");
+    char* p = aligned_alloc(8, 24);
+    if (!p || (uintptr_t)p % 8 != 0) {
+        printf("  ERROR: aligned_alloc(8, 24) failed\n");
+        return 1;
+    }
+    free(p);
+    
+    printf("  Testing bad alignments...\n");
+    if (aligned_alloc(48, 100) != NULL || aligned_alloc(0, 100) != NULL) {
+        printf("  ERROR: accepted an alignment that is not a power of two\n");
+        return 1;
+    }
+    
+    // a cache-line block fits in the same arena as ordinary ones, and is
+    // freed the ordinary way
+    printf("  Testing cache-line blocks...\n");
+    char* a = malloc(200);
+    char* line = aligned_alloc(64, 64);
+    char* b = malloc(200);
+    if (!a || !line || !b || (uintptr_t)line % 64 != 0) {
+        printf("  ERROR: allocation failed\n");
+        return 1;
+    }
+    memset(line, 0xff, 64);
+    free(line);
+    free(a);
+    free(b);
+    
+    printf("Test 8 passed!\n");
+    return 0;
+}
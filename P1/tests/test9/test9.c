@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include "mymalloc.h"
+
+#define BATCH 50
+
+int main() {
+    printf("Test 9: batch malloc and free\n");
+    
+    mymalloc_stats_t before, stats;
+    void* ptrs[BATCH];
+    
+    free(malloc(100));
+    mymalloc_stats(&before);
+    
+    // the blocks are cut from one chunk, so they sit back to back
+    printf("  Testing batch malloc...\n");
+    if (malloc_batch(BATCH, 100, ptrs) != BATCH) {
+        printf("  ERROR: malloc_batch failed\n");
+        return 1;
+    }
+    for (int i = 0; i < BATCH; i++) {
+        memset(ptrs[i], i, 100);
+    }
+    for (int i = 1; i < BATCH; i++) {
+        if ((char*)ptrs[i] != (char*)ptrs[i - 1] + 112) {
+            printf("  ERROR: block %d is not right after block %d\n", i, i - 1);
+            return 1;
+        }
+    }
+    for (int i = 0; i < BATCH; i++) {
+        for (int j = 0; j < 100; j++) {
+            if (((char*)ptrs[i])[j] != i) {
+                printf("  ERROR: block %d was overwritten\n", i);
+                return 1;
+            }
+        }
+    }
+    
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects + BATCH ||
+        stats.malloc_calls != before.malloc_calls + BATCH) {
+        printf("  ERROR: expected %d more live objects and calls\n", BATCH);
+        return 1;
+    }
+    
+    // freed together in any order, the run goes back as one chunk
+    printf("  Testing batch free...\n");
+    void* shuffled[BATCH + 1];
+    for (int i = 0; i < BATCH; i++) {
+        shuffled[i] = ptrs[(i * 7) % BATCH];
+    }
+    shuffled[BATCH] = NULL;
+    free_batch(shuffled, BATCH + 1);
+    
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects || stats.free_chunks != before.free_chunks) {
+        printf("  ERROR: expected the heap to be back as it was, got %zu live and %zu free chunks\n",
+               stats.live_objects - before.live_objects, stats.free_chunks);
+        return 1;
+    }
+    
+    // small sizes come from slabs
+    printf("  Testing small blocks...\n");
+    if (malloc_batch(BATCH, 16, ptrs) != BATCH) {
+        printf("  ERROR: malloc_batch of small blocks failed\n");
+        return 1;
+    }
+    for (int i = 0; i < BATCH; i++) {
+        memset(ptrs[i], 0xff, 16);
+    }
+    free_batch(ptrs, BATCH);
+    
+    // a mix of chunks and slab objects with live blocks in between
+    printf("  Testing mixed batch...\n");
+    void* keep[10];
+    void* mixed[20];
+    for (int i = 0; i < 10; i++) {
+        mixed[2 * i] = malloc(i % 2 ? 200 : 24);
+        keep[i] = malloc(300);
+        mixed[2 * i + 1] = malloc(150);
+    }
+    free_batch(mixed, 20);
+    for (int i = 0; i < 10; i++) {
+        free(keep[i]);
+    }
+    mymalloc_stats(&stats);
+    if (stats.live_objects != before.live_objects) {
+        printf("  ERROR: %zu blocks left live\n", stats.live_objects - before.live_objects);
+        return 1;
+    }
+    
+    printf("  Testing zero blocks...\n");
+    if (malloc_batch(0, 100, ptrs) != 0) {
+        printf("  ERROR: malloc_batch of nothing returned blocks\n");
+        return 1;
+    }
+    free_batch(ptrs, 0);
+    
+    printf("Test 9 passed!\n");
+    return 0;
+}
@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "dict.h"
+
+// Compares the dictionary table in src/dict.c with the fixed-size
+// chained table spell used before it: time to add every word, how much
+// that raised peak memory, and lookups per second for words that are in
+// the dictionary and words that are not. The words come from a
+// dictionary file, one per line, or are made up at random.
+
+#define NUM_WORDS 500000
+#define NUM_ROUNDS 5
+#define HASH_SIZE 50000
+
+// The old table: 50000 buckets, one malloc and one strdup per word
+
+typedef struct chain_entry {
+    char* word;
+    int has_capital;  // 1 if first letter is capital
+    struct chain_entry* next;
+} chain_entry_t;
+
+typedef struct {
+    chain_entry_t** buckets;
+    int size;
+} chain_t;
+
+static unsigned int chain_hash(const char* str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+    return hash % HASH_SIZE;
+}
+
+static chain_t* chain_create() {
+    chain_t* d = malloc(sizeof(chain_t));
+    d->size = HASH_SIZE;
+    d->buckets = calloc(HASH_SIZE, sizeof(chain_entry_t*));
+    return d;
+}
+
+static void chain_add(chain_t* d, const char* word) {
+    char lower[MAX_WORD_LEN];
+    to_lower(lower, word);
+
+    unsigned int h = chain_hash(lower);
+
+    chain_entry_t* curr = d->buckets[h];
+    while (curr) {
+        if (strcmp(curr->word, lower) == 0) {
+            if (isupper(word[0])) {
+                curr->has_capital = 1;
+            }
+            return;
+        }
+        curr = curr->next;
+    }
+
+    chain_entry_t* entry = malloc(sizeof(chain_entry_t));
+    entry->word = strdup(lower);
+    entry->has_capital = isupper(word[0]);
+    entry->next = d->buckets[h];
+    d->buckets[h] = entry;
+}
+
+static int chain_lookup(chain_t* d, const char* word) {
+    char lower[MAX_WORD_LEN];
+    to_lower(lower, word);
+
+    unsigned int h = chain_hash(lower);
+    chain_entry_t* curr = d->buckets[h];
+
+    while (curr) {
+        if (strcmp(curr->word, lower) == 0) {
+            if (curr->has_capital) {
+                return isupper(word[0]);
+            }
+            return 1;
+        }
+        curr = curr->next;
+    }
+    return 0;
+}
+
+static void chain_free(chain_t* d) {
+    for (int i = 0; i < d->size; i++) {
+        chain_entry_t* curr = d->buckets[i];
+        while (curr) {
+            chain_entry_t* next = curr->next;
+            free(curr->word);
+            free(curr);
+            curr = next;
+        }
+    }
+    free(d->buckets);
+    free(d);
+}
+
+// The two tables behind one interface
+typedef struct {
+    const char* name;
+    void* (*create)();
+    void (*add)(void*, const char*);
+    int (*lookup)(void*, const char*);
+    void (*destroy)(void*);
+} table_t;
+
+static void* open_create() { return dict_create(); }
+static void open_add(void* d, const char* word) { dict_add(d, word); }
+static int open_lookup(void* d, const char* word) { return dict_lookup(d, word); }
+static void open_destroy(void* d) { dict_free(d); }
+
+static void* chained_create() { return chain_create(); }
+static void chained_add(void* d, const char* word) { chain_add(d, word); }
+static int chained_lookup(void* d, const char* word) { return chain_lookup(d, word); }
+static void chained_destroy(void* d) { chain_free(d); }
+
+static const table_t tables[] = {
+    {"chained", chained_create, chained_add, chained_lookup, chained_destroy},
+    {"open", open_create, open_add, open_lookup, open_destroy},
+};
+#define NUM_TABLES (int)(sizeof(tables) / sizeof(tables[0]))
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char** read_words(const char* filename, int* count) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        perror("Error opening dictionary");
+        exit(EXIT_FAILURE);
+    }
+
+    int capacity = 1024;
+    char** words = malloc(capacity * sizeof(char*));
+    char line[MAX_WORD_LEN];
+    *count = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            words = realloc(words, capacity * sizeof(char*));
+        }
+        words[(*count)++] = strdup(line);
+    }
+
+    fclose(f);
+    return words;
+}
+
+// Random letters, 3 to 14 of them, one word in ten capitalized
+static char** make_words(int count, unsigned int* seed) {
+    char** words = malloc(count * sizeof(char*));
+
+    for (int i = 0; i < count; i++) {
+        int len = 3 + rand_r(seed) % 12;
+        words[i] = malloc(len + 1);
+        for (int j = 0; j < len; j++) {
+            words[i][j] = 'a' + rand_r(seed) % 26;
+        }
+        if (rand_r(seed) % 10 == 0) {
+            words[i][0] = toupper(words[i][0]);
+        }
+        words[i][len] = '\0';
+    }
+    return words;
+}
+
+// Copies of the words to look up, capitalized so they match whether or
+// not the dictionary entry is, and with a digit on the end for misses,
+// which the made-up words never have
+static char** make_queries(char** words, int count, int miss) {
+    char** queries = malloc(count * sizeof(char*));
+
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(words[i]);
+        if (len > MAX_WORD_LEN - 2) {
+            len = MAX_WORD_LEN - 2;
+        }
+        queries[i] = malloc(len + 2);
+        memcpy(queries[i], words[i], len);
+        queries[i][0] = toupper(queries[i][0]);
+        if (miss) {
+            queries[i][len++] = '7';
+        }
+        queries[i][len] = '\0';
+    }
+    return queries;
+}
+
+// Look up every word rounds times, returns lookups per second
+static double lookup_rate(const table_t* t, void* d, char** words, int count,
+                          int rounds, int expect) {
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            if ((t->lookup(d, words[i]) != 0) != expect) {
+                fprintf(stderr, "Error: %s table got %s wrong\n", t->name, words[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    return (double)count * rounds / (now() - start);
+}
+
+// Peak resident memory of this process so far, in KB
+static long peak_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Load every word, look them all up, and print a line of results. Peak
+// memory is how far loading and lookups raised the process's peak.
+static void run_table(const table_t* table, char** words, char** hits, char** misses,
+                      int count, int rounds) {
+    long base = peak_kb();
+
+    double start = now();
+    void* d = table->create();
+    for (int i = 0; i < count; i++) {
+        table->add(d, words[i]);
+    }
+    double load = now() - start;
+
+    double found = lookup_rate(table, d, hits, count, rounds, 1);
+    double missed = lookup_rate(table, d, misses, count, rounds, 0);
+    printf("%-10s %10.1f %10ld %16.0f %16.0f\n", table->name, load * 1000,
+           peak_kb() - base, found, missed);
+
+    table->destroy(d);
+}
+
+int main(int argc, char** argv) {
+    int count = NUM_WORDS;
+    int rounds = NUM_ROUNDS;
+    unsigned int seed = time(NULL);
+    const char* filename = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-n words] [-r rounds] [-S seed] [dictionary]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (count < 1 || rounds < 1) {
+        fprintf(stderr, "Error: -n and -r must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    char** words;
+    if (filename) {
+        words = read_words(filename, &count);
+        printf("%d words from %s, %d lookup rounds\n", count, filename, rounds);
+    } else {
+        printf("%d random words, seed %u, %d lookup rounds\n", count, seed, rounds);
+        words = make_words(count, &seed);
+    }
+    char** hits = make_queries(words, count, 0);
+    char** misses = make_queries(words, count, 1);
+
+    // every table runs in its own process, so its peak memory is its own
+    printf("%-10s %10s %10s %16s %16s\n", "table", "load ms", "peak KB", "hits/sec", "misses/sec");
+    for (int t = 0; t < NUM_TABLES; t++) {
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) {
+            run_table(&tables[t], words, hits, misses, count, rounds);
+            exit(EXIT_SUCCESS);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(words[i]);
+        free(hits[i]);
+        free(misses[i]);
+    }
+    free(words);
+    free(hits);
+    free(misses);
+    return EXIT_SUCCESS;
+}
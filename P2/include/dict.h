@@ -0,0 +1,84 @@
+#ifndef _DICT_H
+#define _DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_WORD_LEN 256
+
+// Dictionary words are stored in lowercase, with a flag for words that
+// were listed with a capital first letter. The table is open addressed
+// with linear probing and a power-of-two size, and doubles before it is
+// 3/4 full. Each slot keeps the word's full hash, so a probe only looks
+// at the word when the hashes match.
+//
+// The words live one after another in a single growing arena, each as
+// a word_t header followed by its letters and a '\0'. Slots refer to
+// them by offset, so growing the arena does not touch the table, and
+// the whole dictionary is three blocks of memory.
+typedef struct {
+    unsigned char len;          // letters in the word
+    unsigned char has_capital;  // 1 if first letter is capital
+    char text[];
+} word_t;
+
+typedef struct {
+    unsigned int hash;    // full hash of the word
+    unsigned int offset;  // word_t in the arena, 0 for an empty slot
+} dict_entry_t;
+
+typedef struct {
+    dict_entry_t* slots;
+    size_t size;          // number of slots, a power of two
+    size_t count;         // slots in use
+    char* words;          // the arena
+    size_t words_used;
+    size_t words_size;
+    void* map;            // the mapped file for a compiled dictionary
+    size_t map_size;
+} dict_t;
+
+// A compiled dictionary file is the table as it is in memory: this
+// header, then the slots, then the arena. Slots hold offsets into the
+// arena, so the file can be mapped at any address and used as it is.
+#define DICT_MAGIC 0x4c4c5053  // "SPLL"
+#define DICT_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;        // number of slots
+    uint64_t count;       // slots in use
+    uint64_t words_used;  // arena bytes
+} dict_header_t;
+
+unsigned int hash(const char* str);
+
+// Copies src into dest in lowercase and returns its length
+int to_lower(char* dest, const char* src);
+
+dict_t* dict_create();
+void dict_add(dict_t* d, const char* word);
+
+// 1 if word is spelled correctly: it is in the dictionary, and starts
+// with a capital if the dictionary entry does
+int dict_lookup(dict_t* d, const char* word);
+
+// dict_lookup for the len bytes at word, which need not end in '\0'
+int dict_lookup_len(dict_t* d, const char* word, int len);
+
+// Write d to filename as a compiled dictionary. Returns 0, or -1 with
+// errno set if the file could not be written.
+int dict_save(dict_t* d, const char* filename);
+
+// Map the compiled dictionary in fd. Returns 1 and sets *out, 0 if fd
+// does not hold a compiled dictionary, or -1 if its header is damaged.
+// Only the header is checked; a lookup that reaches a slot whose word
+// is not wholly inside the arena prints an error and exits.
+// A mapped dictionary is read-only: it can be looked up and freed, not
+// added to.
+int dict_map(int fd, dict_t** out);
+
+void dict_free(dict_t* d);
+
+#endif
@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dict.h"
+
+#define INITIAL_SIZE 1024
+#define INITIAL_WORDS 16384  // arena bytes to start with
+
+// The end of hash(): the bits are mixed so the low bits used for the
+// slot depend on every character
+static unsigned int mix(unsigned int hash) {
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// djb2, mixed
+unsigned int hash(const char* str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+    return mix(hash);
+}
+
+int to_lower(char* dest, const char* src) {
+    int i = 0;
+    while (src[i]) {
+        dest[i] = tolower(src[i]);
+        i++;
+    }
+    dest[i] = '\0';
+    return i;
+}
+
+static void* dict_alloc(void* ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "Error: out of memory for dictionary\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static dict_entry_t* alloc_slots(size_t size) {
+    dict_entry_t* slots = dict_alloc(NULL, size * sizeof(dict_entry_t));
+    memset(slots, 0, size * sizeof(dict_entry_t));
+    return slots;
+}
+
+dict_t* dict_create() {
+    dict_t* d = dict_alloc(NULL, sizeof(dict_t));
+    d->size = INITIAL_SIZE;
+    d->count = 0;
+    d->slots = alloc_slots(INITIAL_SIZE);
+    d->words_size = INITIAL_WORDS;
+    d->words = dict_alloc(NULL, INITIAL_WORDS);
+    d->words[0] = 0;
+    d->words_used = 1;  // offset 0 marks an empty slot
+    d->map = NULL;
+    d->map_size = 0;
+    return d;
+}
+
+static word_t* word_at(dict_t* d, unsigned int offset) {
+    return (word_t*)(d->words + offset);
+}
+
+// The slots of a mapped dictionary come from the file, so a word is
+// checked when a probe first reads it: its word_t, len letters and a
+// '\0' must all lie before words_used. A bad one ends the program, as
+// there is no right answer to give from a damaged table.
+static void check_word(dict_t* d, size_t offset) {
+    if (offset <= d->words_used - sizeof(word_t)) {
+        word_t* w = word_at(d, offset);
+        if (w->len < d->words_used - sizeof(word_t) - offset && w->text[w->len] == '\0') {
+            return;
+        }
+    }
+    fprintf(stderr, "Error: compiled dictionary is damaged\n");
+    exit(EXIT_FAILURE);
+}
+
+// Slot holding word, or the empty slot where it would go. Only a slot
+// with the same hash and length gets its letters compared.
+static dict_entry_t* find_slot(dict_t* d, const char* word, int len, unsigned int h) {
+    size_t mask = d->size - 1;
+    size_t i = h & mask;
+
+    while (d->slots[i].offset) {
+        if (d->slots[i].hash == h) {
+            if (d->map) {
+                check_word(d, d->slots[i].offset);
+            }
+            word_t* w = word_at(d, d->slots[i].offset);
+            if (w->len == len && memcmp(w->text, word, len) == 0) {
+                return &d->slots[i];
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    return &d->slots[i];
+}
+
+// Double the table, moving every entry to its slot in the new one. The
+// words stay where they are in the arena and their hashes are not
+// recomputed.
+static void grow(dict_t* d) {
+    dict_entry_t* old = d->slots;
+    size_t old_size = d->size;
+
+    d->size *= 2;
+    d->slots = alloc_slots(d->size);
+
+    size_t mask = d->size - 1;
+    for (size_t j = 0; j < old_size; j++) {
+        if (old[j].offset) {
+            size_t i = old[j].hash & mask;
+            while (d->slots[i].offset) {
+                i = (i + 1) & mask;
+            }
+            d->slots[i] = old[j];
+        }
+    }
+    free(old);
+}
+
+// Copy a word to the end of the arena, doubling it when it is full, and
+// return its offset
+static unsigned int store_word(dict_t* d, const char* word, int len, int has_capital) {
+    size_t need = sizeof(word_t) + len + 1;
+
+    if (d->words_used + need > d->words_size) {
+        while (d->words_used + need > d->words_size) {
+            d->words_size *= 2;
+        }
+        d->words = dict_alloc(d->words, d->words_size);
+    }
+
+    unsigned int offset = d->words_used;
+    word_t* w = word_at(d, offset);
+    w->len = len;
+    w->has_capital = has_capital;
+    memcpy(w->text, word, len + 1);
+    d->words_used += need;
+    return offset;
+}
+
+void dict_add(dict_t* d, const char* word) {
+    char lower[MAX_WORD_LEN];
+    int len = to_lower(lower, word);
+
+    unsigned int h = hash(lower);
+
+    // Check if already exists
+    dict_entry_t* entry = find_slot(d, lower, len, h);
+    if (entry->offset) {
+        // Update capitalization if needed
+        if (isupper(word[0])) {
+            word_at(d, entry->offset)->has_capital = 1;
+        }
+        return;
+    }
+
+    // Keep the load factor under 3/4 so probe runs stay short
+    if ((d->count + 1) * 4 > d->size * 3) {
+        grow(d);
+        entry = find_slot(d, lower, len, h);
+    }
+
+    // Add new entry
+    entry->offset = store_word(d, lower, len, isupper(word[0]) != 0);
+    entry->hash = h;
+    d->count++;
+}
+
+int dict_lookup(dict_t* d, const char* word) {
+    return dict_lookup_len(d, word, strlen(word));
+}
+
+int dict_lookup_len(dict_t* d, const char* word, int len) {
+    // no dictionary word is this long
+    if (len > MAX_WORD_LEN - 1) {
+        return 0;
+    }
+
+    // lowercase and hash in one pass, the same hash as hash(lower)
+    char lower[MAX_WORD_LEN];
+    unsigned int h = 5381;
+    for (int i = 0; i < len; i++) {
+        lower[i] = tolower(word[i]);
+        int c = lower[i];
+        h = ((h << 5) + h) + c;
+    }
+    h = mix(h);
+
+    dict_entry_t* entry = find_slot(d, lower, len, h);
+    if (!entry->offset) {
+        return 0;
+    }
+
+    if (word_at(d, entry->offset)->has_capital) {
+        // Dictionary has capital, so input must have capital first letter
+        return isupper(word[0]);
+    }
+    // Dictionary is lowercase, accept any case
+    return 1;
+}
+
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int dict_save(dict_t* d, const char* filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    dict_header_t header = {DICT_MAGIC, DICT_VERSION, d->size, d->count, d->words_used};
+    if (write_all(fd, &header, sizeof(header)) < 0 ||
+        write_all(fd, d->slots, d->size * sizeof(dict_entry_t)) < 0 ||
+        write_all(fd, d->words, d->words_used) < 0) {
+        close(fd);
+        return -1;
+    }
+    return close(fd);
+}
+
+int dict_map(int fd, dict_t** out) {
+    dict_header_t header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != DICT_MAGIC) {
+        return 0;
+    }
+
+    // Only the header is checked here, so that loading does not depend
+    // on the size of the dictionary; find_slot checks each word it
+    // reaches. The sizes come from the file, so they are checked against
+    // each other and the file's length in an order where nothing can wrap.
+    struct stat st;
+    if (header.version != DICT_VERSION || header.size == 0 ||
+        (header.size & (header.size - 1)) != 0 || header.count >= header.size ||
+        header.size > (SIZE_MAX - sizeof(header)) / sizeof(dict_entry_t) ||
+        header.words_used <= sizeof(word_t) || header.words_used > UINT_MAX ||
+        fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(header) ||
+        (uint64_t)st.st_size - sizeof(header) < header.size * sizeof(dict_entry_t) ||
+        (uint64_t)st.st_size - sizeof(header) - header.size * sizeof(dict_entry_t) != header.words_used) {
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    dict_t* d = dict_alloc(NULL, sizeof(dict_t));
+    d->size = header.size;
+    d->count = header.count;
+    d->slots = (dict_entry_t*)((char*)map + sizeof(header));
+    d->words = (char*)(d->slots + header.size);
+    d->words_used = header.words_used;
+    d->words_size = header.words_used;
+    d->map = map;
+    d->map_size = st.st_size;
+    *out = d;
+    return 1;
+}
+
+void dict_free(dict_t* d) {
+    if (d->map) {
+        munmap(d->map, d->map_size);
+    } else {
+        free(d->words);
+        free(d->slots);
+    }
+    free(d);
+}
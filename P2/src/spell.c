@@ -5,99 +5,16 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include "dict.h"
 
 #define BUFFER_SIZE 8192
-#define MAX_WORD_LEN 256
-#define HASH_SIZE 50000
-
-typedef struct dict_entry {
-    char* word;
-    int has_capital;  // 1 if first letter is capital
-    struct dict_entry* next;
-} dict_entry_t;
-
-typedef struct {
-    dict_entry_t** buckets;
-    int size;
-} dict_t;
 
 static dict_t* dictionary = NULL;
 static int error_found = 0;
 
-unsigned int hash(const char* str) {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c;
-    return hash % HASH_SIZE;
-}
-
-dict_t* dict_create() {
-    dict_t* d = malloc(sizeof(dict_t));
-    d->size = HASH_SIZE;
-    d->buckets = calloc(HASH_SIZE, sizeof(dict_entry_t*));
-    return d;
-}
-
-void to_lower(char* dest, const char* src) {
-    int i = 0;
-    while (src[i]) {
-        dest[i] = tolower(src[i]);
-        i++;
-    }
-    dest[i] = '\0';
-}
-
-void dict_add(dict_t* d, const char* word) {
-    char lower[MAX_WORD_LEN];
-    to_lower(lower, word);
-    
-    unsigned int h = hash(lower);
-    
-    // Check if already exists
-    dict_entry_t* curr = d->buckets[h];
-    while (curr) {
-        if (strcmp(curr->word, lower) == 0) {
-            // Update capitalization if needed
-            if (isupper(word[0])) {
-                curr->has_capital = 1;
-            }
-            return;
-        }
-        curr = curr->next;
-    }
-    
-    // Add new entry
-    dict_entry_t* entry = malloc(sizeof(dict_entry_t));
-    entry->word = strdup(lower);
-    entry->has_capital = isupper(word[0]);
-    entry->next = d->buckets[h];
-    d->buckets[h] = entry;
-}
-
-int dict_lookup(dict_t* d, const char* word) {
-    char lower[MAX_WORD_LEN];
-    to_lower(lower, word);
-    
-    unsigned int h = hash(lower);
-    dict_entry_t* curr = d->buckets[h];
-    
-    while (curr) {
-        if (strcmp(curr->word, lower) == 0) {
-            if (curr->has_capital) {
-                // Dictionary has capital, so input must have capital first letter
-                return isupper(word[0]);
-            }
-            // Dictionary is lowercase, accept any case
-            return 1;
-        }
-        curr = curr->next;
-    }
-    return 0;
-}
-
 int load_dictionary(const char* filename) {
     int fd = open(filename, O_RDONLY);
     if (fd < 0) {
@@ -105,6 +22,17 @@ int load_dictionary(const char* filename) {
         return -1;
     }
     
+    // A dictionary made with --compile is mapped and used as it is
+    int mapped = dict_map(fd, &dictionary);
+    if (mapped != 0) {
+        close(fd);
+        if (mapped < 0) {
+            fprintf(stderr, "Error: %s is not a valid compiled dictionary\n", filename);
+            return -1;
+        }
+        return 0;
+    }
+    
     dictionary = dict_create();
     
     char buffer[BUFFER_SIZE];
@@ -135,10 +63,10 @@ int load_dictionary(const char* filename) {
     return 0;
 }
 
-int should_skip_word(const char* word) {
+int should_skip_word(const char* word, int len) {
     int has_letter = 0;
     
-    for (int i = 0; word[i]; i++) {
+    for (int i = 0; i < len; i++) {
         if (isalpha(word[i])) {
             has_letter = 1;
             break;
@@ -148,44 +76,73 @@ int should_skip_word(const char* word) {
     return !has_letter;
 }
 
-void normalize_word(char* dest, const char* src) {
-    int start = 0;
-    int len = strlen(src);
+// Trim word to the part that is checked and return its length; *start
+// is set to where that part begins
+int normalize_word(const char* src, int len, int* start) {
+    int i = 0;
     
     // Skip leading opening punctuation
-    while (start < len && (src[start] == '(' || src[start] == '[' || 
-           src[start] == '{' || src[start] == '\'' || src[start] == '"')) {
-        start++;
+    while (i < len && (src[i] == '(' || src[i] == '[' || 
+           src[i] == '{' || src[i] == '\'' || src[i] == '"')) {
+        i++;
     }
     
     // Find end (before trailing non-alphanum)
     int end = len - 1;
-    while (end >= start && !isalnum(src[end])) {
+    while (end >= i && !isalnum(src[end])) {
         end--;
     }
     
-    // Copy normalized word
-    int j = 0;
-    for (int i = start; i <= end; i++) {
-        dest[j++] = src[i];
-    }
-    dest[j] = '\0';
+    *start = i;
+    return end - i + 1;
 }
 
-void check_file(const char* filename, int print_filename) {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "Error: could not open %s\n", filename);
-        error_found = 1;
+// Where check_file is in the file it is reading
+typedef struct {
+    const char* filename;
+    int print_filename;
+    int line;
+    int col;
+    int word_col;  // column the current word started in
+} scan_t;
+
+// Check one word of input, given as len bytes at word. A word is cut
+// off at its first '\0' and after MAX_WORD_LEN - 1 bytes.
+void check_word(scan_t* scan, const char* word, int len) {
+    if (len > MAX_WORD_LEN - 1) {
+        len = MAX_WORD_LEN - 1;
+    }
+    const char* nul = memchr(word, '\0', len);
+    if (nul) {
+        len = nul - word;
+    }
+    
+    if (should_skip_word(word, len)) {
         return;
     }
     
+    int start;
+    int normalized_len = normalize_word(word, len, &start);
+    const char* normalized = word + start;
+    
+    if (normalized_len > 0 && !dict_lookup_len(dictionary, normalized, normalized_len)) {
+        if (scan->print_filename) {
+            printf("%s:%d:%d %.*s\n", scan->filename, scan->line, scan->word_col,
+                   normalized_len, normalized);
+        } else {
+            printf("%d:%d %.*s\n", scan->line, scan->word_col, normalized_len, normalized);
+        }
+        error_found = 1;
+    }
+}
+
+// Pipes, terminals and anything else that cannot be mapped are read
+// BUFFER_SIZE bytes at a time, and a word is copied out as it goes by,
+// since it may be split between two reads
+void scan_read(scan_t* scan, int fd) {
     char buffer[BUFFER_SIZE];
     char word[MAX_WORD_LEN];
     int word_len = 0;
-    int line = 1;
-    int col = 1;
-    int word_col = 1;
     ssize_t bytes_read;
     
     while ((bytes_read = read(fd, buffer, BUFFER_SIZE)) > 0) {
@@ -194,61 +151,98 @@ void check_file(const char* filename, int print_filename) {
             
             if (isspace(c)) {
                 if (word_len > 0) {
-                    word[word_len] = '\0';
-                    
-                    if (!should_skip_word(word)) {
-                        char normalized[MAX_WORD_LEN];
-                        normalize_word(normalized, word);
-                        
-                        if (normalized[0] && !dict_lookup(dictionary, normalized)) {
-                            if (print_filename) {
-                                printf("%s:%d:%d %s\n", filename, line, word_col, normalized);
-                            } else {
-                                printf("%d:%d %s\n", line, word_col, normalized);
-                            }
-                            error_found = 1;
-                        }
-                    }
-                    
+                    check_word(scan, word, word_len);
                     word_len = 0;
                 }
                 
                 if (c == '\n') {
-                    line++;
-                    col = 1;
+                    scan->line++;
+                    scan->col = 1;
                 } else {
-                    col++;
+                    scan->col++;
                 }
             } else {
                 if (word_len == 0) {
-                    word_col = col;
+                    scan->word_col = scan->col;
                 }
                 if (word_len < MAX_WORD_LEN - 1) {
                     word[word_len++] = c;
                 }
-                col++;
+                scan->col++;
             }
         }
     }
     
     // Handle last word
     if (word_len > 0) {
-        word[word_len] = '\0';
-        if (!should_skip_word(word)) {
-            char normalized[MAX_WORD_LEN];
-            normalize_word(normalized, word);
+        check_word(scan, word, word_len);
+    }
+}
+
+// A regular file is mapped and its words are checked where they are,
+// with no copying. The kernel is told the file is read from start to
+// end, so it can read further ahead.
+void scan_mapped(scan_t* scan, const char* data, size_t size) {
+    size_t word_start = 0;
+    int in_word = 0;
+    
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+        
+        if (isspace(c)) {
+            if (in_word) {
+                size_t len = i - word_start;
+                check_word(scan, data + word_start, len < MAX_WORD_LEN ? (int)len : MAX_WORD_LEN);
+                in_word = 0;
+            }
             
-            if (normalized[0] && !dict_lookup(dictionary, normalized)) {
-                if (print_filename) {
-                    printf("%s:%d:%d %s\n", filename, line, word_col, normalized);
-                } else {
-                    printf("%d:%d %s\n", line, word_col, normalized);
-                }
-                error_found = 1;
+            if (c == '\n') {
+                scan->line++;
+                scan->col = 1;
+            } else {
+                scan->col++;
             }
+        } else {
+            if (!in_word) {
+                in_word = 1;
+                word_start = i;
+                scan->word_col = scan->col;
+            }
+            scan->col++;
         }
     }
     
+    // Handle last word
+    if (in_word) {
+        size_t len = size - word_start;
+        check_word(scan, data + word_start, len < MAX_WORD_LEN ? (int)len : MAX_WORD_LEN);
+    }
+}
+
+void check_file(const char* filename, int print_filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", filename);
+        error_found = 1;
+        return;
+    }
+    
+    scan_t scan = {filename, print_filename, 1, 1, 1};
+    
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    
+    if (data != MAP_FAILED) {
+        posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+        scan_mapped(&scan, data, st.st_size);
+        munmap(data, st.st_size);
+    } else {
+        scan_read(&scan, fd);
+    }
+    
     close(fd);
 }
 
@@ -293,12 +287,35 @@ void process_directory(const char* dirname, const char* suffix) {
     closedir(dir);
 }
 
+// spell --compile dict.txt dict.bin: load a dictionary and write it out
+// in the compiled form that later runs can map without parsing
+int compile_dictionary(const char* source, const char* target) {
+    if (load_dictionary(source) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (dict_save(dictionary, target) < 0) {
+        perror("Error writing compiled dictionary");
+        return EXIT_FAILURE;
+    }
+    dict_free(dictionary);
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
         fprintf(stderr, "Usage: %s [-s suffix] dictionary [file...]\n", argv[0]);
+        fprintf(stderr, "       %s --compile dictionary.txt dictionary.bin\n", argv[0]);
         return EXIT_FAILURE;
     }
     
+    if (strcmp(argv[1], "--compile") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Error: --compile requires a dictionary and an output file\n");
+            return EXIT_FAILURE;
+        }
+        return compile_dictionary(argv[2], argv[3]);
+    }
+    
     char* suffix = ".txt";
     int arg_idx = 1;
     